@@ -1,9 +1,219 @@
+#ifndef LEDPANEL_HOST
 #include "libopencm3/stm32/rcc.h"   //Needed to enable clocks for particular GPIO ports
 #include "libopencm3/stm32/gpio.h"  //Needed to define things on the GPIO
 #include "libopencm3/stm32/adc.h" //Needed to convert analogue signals to digital
+#include "libopencm3/stm32/dma.h" //Needed to stream joystick samples into memory
+#include "libopencm3/stm32/timer.h" //Needed to pace the background row scan
+#include "libopencm3/stm32/usart.h" //Needed to send telemetry to a host
+#include "libopencm3/cm3/nvic.h" //Needed to enable the row scan interrupt
+#include "libopencm3/cm3/dwt.h" //Needed to read the CPU cycle counter for timing measurements
+#include "libopencm3/cm3/systick.h" //Needed to pace the game ticks
+#include "libopencm3/cm3/cortex.h" //Needed to hold interrupts off while going to sleep or taking game ticks
+#include "libopencm3/cm3/scb.h" //Needed to see whether a SysTick interrupt is pending
+#else
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// GPIOC pin bits, matching libopencm3's definitions, for the emulated port
+#define GPIO2 (1 << 2)
+#define GPIO3 (1 << 3)
+#define GPIO4 (1 << 4)
+#define GPIO5 (1 << 5)
+#define GPIO6 (1 << 6)
+#define GPIO7 (1 << 7)
+#define GPIO8 (1 << 8)
+#define GPIO9 (1 << 9)
+#endif
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
+// Shift-out build options (override with -D on the compiler command line)
+#ifndef SHIFT_UNROLL
+#define SHIFT_UNROLL 1 // 1 = fully unroll the 32-pixel loops in shiftOutWord
+#endif
+#ifndef SHIFT_LIBRARY_CALLS
+#define SHIFT_LIBRARY_CALLS 0 // 1 = use the original set/clear-per-pin shift-out, for comparison
+#endif
+#ifndef SHIFT_STATS
+#define SHIFT_STATS 0 // 1 = count GPIO register writes while scanning and CPU cycles spent in pushToRow
+#endif
+
+// Colour depth in bits per channel. 1 gives the original 8 on/off colours; 2-8 use
+// Binary Code Modulation, showing plane b of each row for a time proportional to 2^b.
+#ifndef COLOUR_DEPTH
+#define COLOUR_DEPTH 1
+#endif
+#if COLOUR_DEPTH < 1 || COLOUR_DEPTH > 8
+#error "COLOUR_DEPTH must be between 1 and 8"
+#endif
+#define COLOUR_MAX ((1 << COLOUR_DEPTH) - 1) // Full intensity of a channel
+
+// Joystick sampling options
+#ifndef JOYSTICK_OVERSAMPLE
+#define JOYSTICK_OVERSAMPLE 8 // Samples per joystick averaged on each read
+#endif
+#ifndef JOYSTICK_HYSTERESIS
+#define JOYSTICK_HYSTERESIS 200 // How far back past a threshold a reading must fall to release a direction
+#endif
+#ifndef INPUT_STATS
+#define INPUT_STATS 0 // 1 = measure joystick read cycles and sample-to-move latency, against the old blocking reads
+#endif
+#define JOYSTICK_BLOCKING_READS 16 // Blocking conversions INPUT_STATS times at startup for comparison
+
+#ifndef ATTRACT_MODE
+#define ATTRACT_MODE 1 // 1 = play an animated attract loop until a joystick is moved
+#endif
+
+// CPU player options
+#ifndef CPU_PLAYERS
+#define CPU_PLAYERS 0 // Paddles the CPU plays: 1 = player 1's, 2 = player 2's, 3 = both, for an unattended demo
+#endif
+#ifndef CPU_REACTION_TICKS
+#define CPU_REACTION_TICKS 4 // Game ticks between the ball moving and the CPU seeing it, at most 15
+#endif
+#ifndef CPU_ERROR_ROWS
+#define CPU_ERROR_ROWS (DISPLAY_HEIGHT * 3 / 16) // Most rows the CPU misjudges the ball's arrival by, chosen afresh for each approach: 6 on a 32-row display. Past PADDLELENGTH / 2 it can miss.
+#endif
+#if CPU_REACTION_TICKS < 0 || CPU_REACTION_TICKS > 15
+#error "CPU_REACTION_TICKS must be between 0 and 15"
+#endif
+#define CPU_HISTORY 16 // Ticks of ball positions remembered for the reaction delay, a power of two
+
+// Text options
+#ifndef SCORE_OVERLAY
+#define SCORE_OVERLAY 1 // 1 = show both players' scores at the top of the display
+#endif
+#ifndef TEXT_STATS
+#define TEXT_STATS 0 // 1 = count glyphs drawn and CPU cycles spent in drawText
+#endif
+
+// Display geometry options. Panels are chained left to right on one data line, and every
+// loop over rows, columns and panels is bounded by these constants.
+#ifndef PANEL_WIDTH
+#define PANEL_WIDTH 32 // Columns on one panel, a multiple of 32
+#endif
+#ifndef PANEL_HEIGHT
+#define PANEL_HEIGHT 32 // Rows on one panel
+#endif
+#ifndef PANEL_SCAN
+#define PANEL_SCAN (PANEL_HEIGHT / 2) // 1/PANEL_SCAN scan: row addresses, each driving one row in each half of the panel
+#endif
+#ifndef PANEL_CHAIN
+#define PANEL_CHAIN 1 // Panels daisy-chained along the data line
+#endif
+#if PANEL_WIDTH < 32 || PANEL_WIDTH % 32
+#error "PANEL_WIDTH must be a multiple of 32"
+#endif
+#if PANEL_HEIGHT != 2 * PANEL_SCAN
+#error "Only panels driving one row in each half per address are supported (1/8 scan at 16 rows, 1/16 at 32, 1/32 at 64)"
+#endif
+#if PANEL_SCAN == 8
+#define ROW_ADDRESS_BITS 3 // Address lines A-C
+#elif PANEL_SCAN == 16
+#define ROW_ADDRESS_BITS 4 // Address lines A-D
+#elif PANEL_SCAN == 32
+#define ROW_ADDRESS_BITS 5 // Address lines A-E
+#else
+#error "PANEL_SCAN must be 8, 16 or 32"
+#endif
+#if PANEL_CHAIN < 1
+#error "PANEL_CHAIN must be at least 1"
+#endif
+#define DISPLAY_WIDTH (PANEL_WIDTH * PANEL_CHAIN) // Columns across the whole chain
+#define DISPLAY_HEIGHT PANEL_HEIGHT
+#define PANEL_WORDS (PANEL_WIDTH / 32) // Frame buffer words per row of one panel
+#define ROW_WORDS (DISPLAY_WIDTH / 32) // Frame buffer words per row of the display
+
+// Sets of rows are kept as bit masks, one bit per row
+#if DISPLAY_HEIGHT > 32
+typedef uint64_t rowMask;
+#define ROWMASK_CTZ __builtin_ctzll
+#define ROWMASK_POPCOUNT __builtin_popcountll
+#else
+typedef uint32_t rowMask;
+#define ROWMASK_CTZ __builtin_ctz
+#define ROWMASK_POPCOUNT __builtin_popcount
+#endif
+#define ROWMASK_BITS (8 * (int)sizeof(rowMask))
+
+#ifndef CLOCK_64MHZ
+#define CLOCK_64MHZ (PANEL_CHAIN > 1 || COLOUR_DEPTH > 1) // 1 = run the STM32 at 64MHz from the PLL instead of the 8MHz reset clock
+#endif
+
+// Game tick scheduler options
+#ifndef GAME_TICK_HZ
+#define GAME_TICK_HZ 50 // Game updates per second, paced by SysTick (at least 4 at 64MHz for its 24-bit counter)
+#endif
+#ifndef GAME_MAX_CATCHUP
+#define GAME_MAX_CATCHUP 4 // Most late ticks run back to back after a slow frame; any more are dropped
+#endif
+
+// Background scan options
+#ifndef SCAN_REFRESH_HZ
+#define SCAN_REFRESH_HZ 120 // Target full-panel refreshes per second; refreshRateHz reports what is achieved
+#endif
+#define SCAN_ROWS PANEL_SCAN // Row addresses per refresh (each drives a row in both halves of the panel)
+
+// Stage profiler options. With PROFILE 0 every PROFILE_* macro compiles to nothing.
+#ifndef PROFILE
+#define PROFILE 0 // 1 = record the cycles spent in each stage of a frame and send them as telemetry
+#endif
+#ifndef PROFILE_RING_SIZE
+#define PROFILE_RING_SIZE 128 // Most recent samples kept per stage
+#endif
+#ifndef PROFILE_DUMP_TICKS
+#define PROFILE_DUMP_TICKS 50 // Game ticks between telemetry records
+#endif
+#ifndef TELEMETRY_BAUD
+#define TELEMETRY_BAUD 115200 // USART2 baud rate for the telemetry link
+#endif
+
+// Frame streaming options
+#ifndef STREAM_MODE
+#define STREAM_MODE 0 // 1 = show frames streamed from a host over USART2 instead of running the game
+#endif
+#ifndef STREAM_BAUD
+#define STREAM_BAUD 460800 // USART2 baud rate for the frame stream
+#endif
+#ifndef STREAM_RING_SIZE
+#define STREAM_RING_SIZE 4096 // Bytes in the DMA receive ring, a power of two
+#endif
+#if STREAM_RING_SIZE & (STREAM_RING_SIZE - 1)
+#error "STREAM_RING_SIZE must be a power of two"
+#endif
+#if STREAM_MODE && PROFILE && STREAM_BAUD != TELEMETRY_BAUD
+#error "The frame stream and telemetry share USART2, so STREAM_BAUD must equal TELEMETRY_BAUD"
+#endif
+
+// Stream packets: sync bytes 0xA5 0x5A, u8 type, u8 sequence number, u16 payload length, the payload,
+// then a Fletcher-16 checksum (sum1, sum2) of everything from the type byte to the end of the payload
+#define STREAM_SYNC1 0xA5
+#define STREAM_SYNC2 0x5A
+#define STREAM_FULL 0 // Payload is the whole frame buffer, as laid out in struct frameBuffer
+#define STREAM_DELTA 1 // Payload is changes to the previous frame: items of u16 first word, u8 word count, the words
+#define STREAM_HEADER_SIZE 4
+#define STREAM_FRAME_BYTES (COLOUR_DEPTH * 3 * DISPLAY_HEIGHT * ROW_WORDS * 4) // sizeof(struct frameBuffer)
+#if STREAM_MODE && STREAM_FRAME_BYTES > 65535
+#error "A full frame has to fit in a stream packet's 16-bit length"
+#endif
+
+// Replay files: a 24-byte header holding the display geometry and starting game state, then one
+// input byte per game tick (see packInput). Written by the simulator, played back by main.
+#define REPLAY_MAGIC 0x5052 // "RP"
+#define REPLAY_VERSION 1
+#define REPLAY_HEADER_SIZE 24
+
+#if PROFILE
+#define PROFILE_START(name) uint32_t name##Start = halCycles()
+#define PROFILE_END(stage, name) profileRecord(stage, halCycles() - name##Start)
+#else
+#define PROFILE_START(name)
+#define PROFILE_END(stage, name)
+#endif
+
 struct pixel
 {
 	int red;
@@ -11,6 +221,53 @@ struct pixel
 	int blue;
 };
 
+struct bitPlane
+// One bit of every channel for every pixel: ROW_WORDS 32-bit words per row for each colour
+// (384 bytes for a single 32x32 panel)
+{
+	uint32_t red[DISPLAY_HEIGHT][ROW_WORDS]; // Bit n of red[y][w] is the red channel of pixel (32w + n, y)
+	uint32_t green[DISPLAY_HEIGHT][ROW_WORDS];
+	uint32_t blue[DISPLAY_HEIGHT][ROW_WORDS];
+};
+
+struct frameBuffer
+// Packed display buffer holding COLOUR_DEPTH bit planes, least significant first
+{
+	struct bitPlane plane[COLOUR_DEPTH];
+};
+
+struct paletteEntry
+// One sprite palette colour, 8 bits per channel (scaled down to COLOUR_DEPTH when drawn)
+{
+	uint8_t red;
+	uint8_t green;
+	uint8_t blue;
+};
+
+struct sprite
+// Run-length encoded, palettized image kept in flash; made by tools/sprite_convert.py.
+// Each row is a series of one-byte runs: high nibble is length - 1, low nibble is the palette index.
+{
+	uint8_t width; // At most 32
+	uint8_t height;
+	uint8_t frameCount;
+	uint8_t colourCount; // Palette entries, including the transparent entry 0
+	const struct paletteEntry* palette;
+	const uint8_t* data; // Runs for every frame, one after another
+	const uint16_t* frames; // Offset in data of each frame's first run
+};
+
+struct font
+// Fixed-width bitmap font kept in flash; made by tools/font_convert.py.
+// Each glyph is one byte per row, top first, with bit n lighting column n of the glyph.
+{
+	uint8_t width; // At most 8; glyphs are drawn one column apart
+	uint8_t height; // At most 8
+	uint8_t first; // Character code of the first glyph
+	uint8_t count; // Glyphs in rows
+	const uint8_t* rows; // height bytes for each glyph, one glyph after another
+};
+
 struct gameInfo
 {
 	int paddle1Position; // Location of top of player 1's paddle
@@ -21,364 +278,2701 @@ struct gameInfo
 
 	int ballXDirection; // 0 = moving left, 1 = moving right
 	int ballYDirection; // 0 = moving down, 1 = moving up
+
+	int score1; // Balls player 2 has let past
+	int score2; // Balls player 1 has let past
+};
+
+struct ballState
+// Where the ball is and which way it is moving, as in struct gameInfo
+{
+	int16_t ballXCoordinate;
+	int16_t ballYCoordinate;
+	int16_t ballXDirection;
+	int16_t ballYDirection;
+};
+
+struct cpuPlayer
+// How one CPU-driven paddle is misjudging the ball
+{
+	uint32_t random; // State of its error generator, never 0
+	int error; // Rows its aim is off by on the current approach
+	int lastXDirection; // Ball direction it last saw, to notice a new approach
+};
+
+struct renderState
+// The objects a frame buffer currently shows, so the next frame only has to redraw the rows that change
+{
+	int drawn; // 0 until the buffer has been rendered once
+	int ballXCoordinate;
+	int ballYCoordinate;
+	int paddle1Position;
+	int paddle2Position;
+	int score1;
+	int score2;
+};
+
+struct renderStats
+// Work done by the last call to renderFrame, and in total since startup
+{
+	rowMask dirtyRows; // Mask of the rows that were cleared and redrawn
+	uint32_t rowsRedrawn; // Number of rows in dirtyRows
+	uint32_t pixelsTouched; // Pixels cleared plus pixels drawn, including the score's glyph pixels
+	uint32_t frames; // Calls to renderFrame; divide the totals by this for per-frame averages
+	uint32_t totalRowsRedrawn;
+	uint64_t totalPixelsTouched;
 };
 
 const int INPUTSIGNAL = GPIO6;
 const int CLOCK = GPIO7;
 const int LATCH = GPIO8;
-const int ROWSELECT[] = {GPIO5,GPIO4,GPIO3,GPIO2};
-const int ALLPINS[] = {GPIO2,GPIO3,GPIO4,GPIO5,GPIO6,GPIO7,GPIO8}
-const int MAXROWLENGTH = 192;
-const int PADDLELENGTH = 9; 
+const int ROWSELECT[] = {GPIO9,GPIO5,GPIO4,GPIO3,GPIO2}; // Address lines E to A; the last ROW_ADDRESS_BITS are used
+const int ALLPINS[] = {GPIO2,GPIO3,GPIO4,GPIO5,GPIO6,GPIO7,GPIO8
+#if ROW_ADDRESS_BITS > 4
+	,GPIO9
+#endif
+};
+const int MAXROWLENGTH = 6 * DISPLAY_WIDTH; // Bits shifted along the chain per row address: 3 colours for 2 rows
+const int PADDLELENGTH = DISPLAY_HEIGHT * 9 / 32; // 9 on a 32-row display
+const int SCOREROW = 1; // Top row of the score digits
+
+// Precomputed BSRR patterns for shifting one bit: index 0 sends a 0, index 1 sends a 1.
+// Each pattern drives the data line and pulls the clock low in a single register write.
+uint32_t shiftBitPattern[2];
+uint32_t shiftClockHigh; // BSRR pattern that raises the clock to push the bit in
+
+// Double-buffered display: the scan interrupt shows frontBuffer while the game draws into backBuffer.
+// The two are only exchanged by the interrupt between refreshes (vsync), so a frame is never shown half-drawn.
+struct frameBuffer frameBuffers[2];
+struct frameBuffer* volatile frontBuffer = &frameBuffers[0];
+struct frameBuffer* volatile backBuffer = &frameBuffers[1];
+volatile int swapRequested; // Set by the game, cleared by the interrupt once the buffers are swapped
+// ADC1 converts channels 1 and 6 continuously and DMA writes them here in turn, overwriting the oldest pair
+volatile uint16_t joyStickSamples[JOYSTICK_OVERSAMPLE * 2]; // Even entries are channel 1 (player 1), odd are channel 6 (player 2)
+int joyStickState[2]; // Last direction reported for each player, used for hysteresis
+
+#if INPUT_STATS
+struct inputStats
+{
+	uint32_t ringPasses; // Times DMA has filled the whole sample buffer
+	uint32_t readCycles; // CPU cycles spent in readValueFromJoyStick
+	uint32_t reads; // Number of calls to readValueFromJoyStick
+	uint32_t blockingCycles; // CPU cycles the original blocking reads took, timed at startup
+	uint32_t blockingReads;
+	uint32_t latencyCycles; // From the DMA pass that changed a direction to the read that acted on it, in total
+	uint32_t maxLatencyCycles;
+	uint32_t latencies; // Direction changes timed
+};
+
+volatile struct inputStats inputStats;
+int joyStickSampledState[2]; // Direction each player's samples gave at the end of the last DMA pass
+uint32_t joyStickChangeCycles[2]; // When a DMA pass last changed that direction
+int joyStickChangePending[2]; // Set until a read acts on the change
+#endif
+
+struct renderState bufferContents[2]; // What each of frameBuffers[] currently holds
+struct ballState cpuHistory[CPU_HISTORY]; // The ball on each recent tick, at index tick % CPU_HISTORY
+uint32_t cpuTicks; // Ticks recorded in cpuHistory
+struct cpuPlayer cpuPlayers[2] = {{0x2545F491u, 0, -1}, {0x9E3779B9u, 0, -1}};
+struct renderStats renderStats;
+
+volatile int scanRow; // Row address the next interrupt will display
+volatile int scanPlane; // Bit plane of that row the next interrupt will display
+uint32_t scanPlanePeriod[COLOUR_DEPTH]; // Timer ticks each bit plane's slot lasts, weighted by 2^plane
+
+struct schedulerStats
+// Game tick timing. The counts run from startup; the rest are measured over the last second.
+{
+	uint32_t ticksRun; // Game updates run
+	uint32_t missedDeadlines; // Ticks that started after the next tick was already due
+	uint32_t droppedTicks; // Ticks skipped because more than GAME_MAX_CATCHUP were waiting
+	uint32_t idlePercent; // Share of the time spent asleep waiting for an interrupt
+	uint32_t jitterCycles; // Spread between the earliest and latest tick start, relative to when each fell due
+	uint32_t maxLatenessCycles; // Longest a tick waited to start after falling due
+};
+
+volatile uint32_t ticksDue; // Game ticks that have fallen due but not been run, added to by the tick interrupt
+volatile uint32_t tickDueCycles; // Cycle count when the latest tick fell due
+struct schedulerStats schedulerStats;
+uint32_t schedulerWindowTicks; // Ticks fallen due in the current one-second window
+uint32_t schedulerIdleCycles; // Cycles asleep in the current window
+uint32_t schedulerMinLateness; // Earliest and latest tick starts in the current window
+uint32_t schedulerMaxLateness;
+
+#if STREAM_MODE
+enum streamState
+{
+	STREAM_WAIT_SYNC1, // Looking for the start of a packet
+	STREAM_WAIT_SYNC2,
+	STREAM_HEADER,
+	STREAM_PAYLOAD,
+	STREAM_CHECKSUM
+};
+
+struct streamParser
+// Progress through the packet being received. Payload bytes go straight into the back buffer.
+{
+	uint32_t consumed; // Bytes taken from the ring since the stream started
+	enum streamState state;
+	uint8_t header[STREAM_HEADER_SIZE]; // Type, sequence number, payload length
+	uint8_t checksum[2];
+	uint32_t count; // Bytes of the header, payload or checksum read so far
+	uint32_t length; // Payload length
+	uint32_t sum1; // Running Fletcher-16 sums
+	uint32_t sum2;
+	int writing; // 0 while skipping a delta that has no frame to apply to
+	uint8_t item[3]; // Header of the delta item being read
+	uint32_t itemCount; // Bytes of that header read so far
+	uint32_t itemOffset; // Frame buffer byte the next delta byte goes to
+	uint32_t itemLeft; // Delta bytes still to come for the item
+	int lastSequence; // Sequence number of the previous packet, -1 before the first
+	int needFull; // Set until a full frame arrives, after a torn frame or lost bytes
+	rowMask changedRows; // Rows the packet being received writes to
+	rowMask shownRows; // Rows changed by the frame on show, which the back buffer doesn't have yet
+};
+
+struct streamStats
+// Frame stream counts since startup, and the frame rate over the last second
+{
+	uint32_t framesShown;
+	uint32_t fullFrames; // Frames shown that were sent whole
+	uint32_t deltaFrames; // Frames shown that were sent as changes
+	uint32_t droppedFrames; // Sequence numbers that never arrived, and deltas skipped while waiting for a full frame
+	uint32_t tornFrames; // Packets cut short or failing their length or checksum checks
+	uint32_t overruns; // Times DMA lapped the parser and unread bytes were lost
+	uint32_t bytes; // Bytes parsed
+	uint32_t framesPerSecond;
+};
+
+uint8_t streamRing[STREAM_RING_SIZE]; // Filled in turn by DMA as bytes arrive, wrapping at the end
+struct streamParser streamParser;
+struct streamStats streamStats;
+uint32_t streamWindowFrames; // Frames shown in the current one-second window
+uint32_t streamWindowStart; // Cycle count at the start of the window
+#endif
+
+volatile uint32_t refreshRateHz; // Measured full-panel refreshes over the last second
+volatile uint32_t refreshCount; // Refreshes completed since the last measurement
+volatile uint32_t refreshWindowStart; // Cycle count at the start of the measurement window
+
+#if PROFILE
+enum profileStage
+{
+	PROFILE_GAME, // Game update: reading input and stepGame
+	PROFILE_RENDER, // Drawing into the back buffer
+	PROFILE_VSYNC, // Waiting for the scanner to take the new frame
+	PROFILE_SCAN, // One row slot of the scan interrupt
+	PROFILE_SPRITE, // Decoding one sprite frame into the frame buffer
+	PROFILE_TEXT, // Drawing the score or the attract loop's message
+	PROFILE_STAGES
+};
+
+struct profileStats
+// Cycle counts for one stage since the last telemetry record
+{
+	uint32_t samples[PROFILE_RING_SIZE]; // Most recent cycle counts, oldest overwritten first
+	uint32_t count; // Samples recorded, including ones already overwritten
+	uint32_t min;
+	uint32_t max;
+	uint64_t total;
+};
+
+// Telemetry record, little-endian: a 16-byte header followed by one block per stage
+#define PROFILE_MAGIC 0x4650 // "PF"
+#define PROFILE_VERSION 1
+#define PROFILE_HEADER_SIZE 16
+#define PROFILE_STAGE_SIZE (20 + 4 * PROFILE_RING_SIZE)
+#define PROFILE_RECORD_SIZE (PROFILE_HEADER_SIZE + PROFILE_STAGES * PROFILE_STAGE_SIZE)
+
+// Samples are added from the scan interrupt as well as the game loop. A record can pick up a
+// sample that is half written, which only ever affects one value.
+volatile struct profileStats profileStats[PROFILE_STAGES];
+uint8_t profileRecordBuffer[PROFILE_RECORD_SIZE]; // Must stay untouched while the telemetry link sends it
+uint32_t profileSequence; // Number of records built, so gaps show up on the host
+uint32_t profileDropped; // Records skipped because the link was still busy
+int profileTicksSinceDump;
+#endif
+
+#if TEXT_STATS
+struct textStats
+{
+	uint32_t glyphsDrawn; // Glyphs at least partly on the display
+	uint32_t cycles; // CPU cycles spent in drawText
+};
+
+struct textStats textStats; // Divide glyphsDrawn by cycles for the drawing rate
+#endif
+
+#if SHIFT_STATS
+struct shiftStats
+{
+	uint32_t rowsShifted; // Number of calls to pushToRow, i.e. row addresses shifted into the chain
+	uint32_t registerWrites; // GPIO register writes: shifting, latching and selecting the row address
+	uint32_t cycles; // CPU cycles spent in pushToRow
+};
+
+volatile struct shiftStats shiftStats; // Divide by rowsShifted for per-row figures
+#endif
 
 // RGB representations for colours used (blank is an off pixel)
-const struct pixel red = {1,0,0};
-const struct pixel blue = {0,0,1};
-const struct pixel white = {1,1,1};
+const struct pixel red = {COLOUR_MAX,0,0};
+const struct pixel blue = {0,0,COLOUR_MAX};
+const struct pixel white = {COLOUR_MAX,COLOUR_MAX,COLOUR_MAX};
 const struct pixel blank = {0,0,0};
 
 void moveBallVertical(struct gameInfo* ballInfo);
 void moveBallHorizontal(struct gameInfo* ballInfo);
-void movePaddle(int player1or2,struct gameInfo* paddleInfo);
+void movePaddle(int player1or2,struct gameInfo* paddleInfo, int direction);
 int paddleExists(int ballYposition, int paddlePosition, int length);
-void drawPaddlesToScreen(struct pixel screen[32][32],int paddle1Position, int paddle2Position);
-void drawBallToScreen(struct pixel Screen[32][32], int  ballXPosition, int ballYPosition);
+uint8_t packInput(int direction1, int direction2);
+int inputDirection(uint8_t input, int player1Or2);
+void stepGame(struct gameInfo* game, uint8_t input);
+uint32_t loadReplay(struct gameInfo* game);
+int predictBall(const struct ballState* ball, int player1Or2, int* ticks);
+int cpuDirection(const struct gameInfo* game, int player1Or2);
+uint8_t cpuInput(const struct gameInfo* game, uint8_t input, int players);
+rowMask rowSpanMask(int top, int length);
+void drawColumnRows(struct frameBuffer* screen, int column, rowMask rows, struct pixel colour);
+void drawColumnSpan(struct frameBuffer* screen, int column, int top, int length, struct pixel colour);
+void drawPaddlesToScreen(struct frameBuffer* screen,int paddle1Position, int paddle2Position);
+void drawBallToScreen(struct frameBuffer* screen, int  ballXPosition, int ballYPosition);
+void clearRows(struct frameBuffer* screen, rowMask rows);
+rowMask renderFrame(struct frameBuffer* screen, struct renderState* shown, const struct gameInfo* game);
+void drawSprite(struct frameBuffer* screen, const struct sprite* sprite, int frame, int x, int y);
+int textWidth(const struct font* font, int length);
+int drawText(struct frameBuffer* screen, const struct font* font, int x, int y, const char* text, struct pixel colour);
+void drawMarquee(struct frameBuffer* screen, const struct font* font, int y, const char* text, int tick, struct pixel colour);
+int drawScore(struct frameBuffer* screen, const struct gameInfo* game);
+void drawAttractFrame(struct frameBuffer* screen, int tick);
 void selectRow(int rowNum);
-void pushToRow(struct pixel pixelArray[32]);
+void initShiftOut(void);
+void shiftOutWord(uint32_t bits);
+void shiftOutWordLibrary(uint32_t bits);
+void pushToRow(int rowNum, const struct bitPlane* plane);
+int filterJoyStick(int player1Or2, int* state);
 int readValueFromJoyStick(int player1Or2); 
-void clearScreen(struct pixel screen[32][32]);
+#if INPUT_STATS
+void joyStickSampled(void);
+void measureBlockingReads(void);
+#endif
+uint8_t nextInput(uint32_t* replayTicks, const struct gameInfo* game);
+void clearScreen(struct frameBuffer* screen);
+void initScanner(void);
+void scanNextRow(void);
+void swapBuffers(void);
+void initScheduler(void);
+void gameTickDue(void);
+int tickIsDue(void);
+int swapDone(void);
+void schedulerIdle(int (*ready)(void));
+int takeTicks(void);
+int waitForTicks(void);
+#if STREAM_MODE
+int streamPoll(struct frameBuffer* back);
+void streamFrames(void);
+#endif
+#if PROFILE
+void profileRecord(enum profileStage stage, uint32_t cycles);
+void profileDump(void);
+void profileTick(void);
+#endif
 
-void moveBallVertical(struct gameInfo* ballInfo)
-// Handles vertical movement of the ball
+// Hardware abstraction layer.
+// Display, game and input code only reach the hardware through the hal* functions below.
+// The STM32 backend drives GPIOC, TIM2, ADC1 and DMA1 through libopencm3. The host backend
+// (build with -DLEDPANEL_HOST) emulates the panel's shift registers, latch and row address
+// on Linux, runs the scan timer in virtual time and replays joystick input from a script.
+void halInit(void);
+static inline void halWritePins(uint32_t pattern); // BSRR-style write: low half sets pins, high half resets them
+static inline void halSetPins(uint32_t pins);
+static inline void halClearPins(uint32_t pins);
+void halStartRowTimer(uint32_t ticks);
+static inline void halSetRowTimerPeriod(uint32_t ticks);
+uint32_t halTimerFrequency(void);
+static inline uint32_t halCycles(void);
+uint32_t halCyclesPerSecond(void);
+void halStartJoySticks(volatile uint16_t* samples, int count);
+#if INPUT_STATS
+uint32_t halReadJoyStickBlocking(int player1Or2); // The original single-channel, wait-for-EOC read, for comparison
+static inline uint32_t halLatencyCycles(void); // Clock for input latency, in halCycles units
+#endif
+static inline void halDisableInterrupts(void); // Holds interrupts off for a short critical section
+static inline void halEnableInterrupts(void);
+void halStartTickTimer(uint32_t hz); // Calls gameTickDue hz times a second
+uint32_t halIdle(int (*ready)(void)); // Sleeps until an interrupt unless ready() already holds; returns the cycles spent asleep
+void halStartTelemetry(void);
+int halTelemetryBusy(void);
+void halWriteTelemetry(const uint8_t* data, int length); // data must stay untouched until halTelemetryBusy returns 0
+int halReadReplay(uint8_t* data, int length); // Reads the next bytes of the replay to play back; returns how many there were
+#if STREAM_MODE
+void halStartStream(uint8_t* ring, int size); // Starts received stream bytes filling ring in turn, wrapping at the end
+uint32_t halStreamReceived(void); // Total bytes written into the ring since halStartStream
+#endif
+
+#ifndef LEDPANEL_HOST
+
+void halInit(void)
+// Sets up the clocks, the display pins on GPIOC and ADC1
 {
-	if (ballInfo->ballYDirection) // If ball is moving up
+	int i;
+
+#if CLOCK_64MHZ
+	rcc_clock_setup_pll(&rcc_hsi_configs[RCC_CLOCK_HSI_64MHZ]); // Long chains and colour depth need the extra shift speed
+#endif
+	dwt_enable_cycle_counter(); // Used for delays and timing measurements
+
+	rcc_periph_clock_enable(RCC_GPIOC);
+
+	for (i = 0; i < (int)(sizeof ALLPINS / sizeof ALLPINS[0]); i++) 
+	{
+		gpio_mode_setup(GPIOC, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, ALLPINS[i]); // GPIO Port Name, GPIO Mode, GPIO Push Up Pull Down Mode, GPIO Pin Number
+		gpio_set_output_options(GPIOC, GPIO_OTYPE_PP, GPIO_OSPEED_100MHZ, ALLPINS[i]);
+	}
+	rcc_periph_clock_enable(RCC_ADC12); // Enable clock for ADC registers 1 and 2
+
+	adc_power_off(ADC1);  // turn off ADC register 1 whist we set it up
+
+	adc_set_clk_prescale(ADC1, ADC_CCR_CKMODE_DIV1);  // Setup a scaling, none is fine for this
+	adc_disable_external_trigger_regular(ADC1);   // We don't need to externally trigger the register...
+	adc_set_right_aligned(ADC1);  // Make sure it is right aligned to get more usable values
+	adc_set_sample_time_on_all_channels(ADC1, ADC_SMPR_SMP_61DOT5CYC);  // Set up sample time
+	adc_set_resolution(ADC1, ADC_CFGR1_RES_12_BIT);  // Get a good resolution
+
+	adc_power_on(ADC1);  // Finished setup, turn on ADC register 1
+}
+
+static inline void halWritePins(uint32_t pattern)
+{
+	GPIO_BSRR(GPIOC) = pattern;
+}
+
+static inline void halSetPins(uint32_t pins)
+{
+	gpio_set(GPIOC, pins);
+}
+
+static inline void halClearPins(uint32_t pins)
+{
+	gpio_clear(GPIOC, pins);
+}
+
+void halStartRowTimer(uint32_t ticks)
+// Starts TIM2 raising an update interrupt every ticks timer clocks
+{
+	rcc_periph_clock_enable(RCC_TIM2);
+	timer_set_mode(TIM2, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+	timer_set_prescaler(TIM2, 0); // Count at the full timer clock for fine plane timing
+	timer_set_period(TIM2, ticks - 1);
+	timer_enable_irq(TIM2, TIM_DIER_UIE);
+	nvic_enable_irq(NVIC_TIM2_IRQ);
+	timer_enable_counter(TIM2);
+}
+
+static inline void halSetRowTimerPeriod(uint32_t ticks)
+// Changes the length of the timer period that has just started
+{
+	timer_set_period(TIM2, ticks - 1);
+}
+
+uint32_t halTimerFrequency(void)
+{
+	// TIM2 runs at the APB1 clock, or at twice it when APB1 is divided down from the AHB clock
+	return rcc_apb1_frequency < rcc_ahb_frequency ? 2 * rcc_apb1_frequency : rcc_apb1_frequency;
+}
+
+static inline uint32_t halCycles(void)
+{
+	return dwt_read_cycle_counter();
+}
+
+uint32_t halCyclesPerSecond(void)
+{
+	return rcc_ahb_frequency;
+}
+
+void tim2_isr(void)
+// Row scan interrupt
+{
+	timer_clear_flag(TIM2, TIM_SR_UIF);
+	scanNextRow();
+}
+
+void halStartJoySticks(volatile uint16_t* samples, int count)
+// Sets ADC1 up to convert both joystick channels continuously, with DMA copying each result
+// into samples in turn and wrapping after count results
+{
+	uint8_t channelArray[] = {1, 6};  // Player 1 on channel 1, player 2 on channel 6
+
+	rcc_periph_clock_enable(RCC_DMA1);
+
+	// DMA1 channel 1 serves ADC1: copy each 16-bit result into the next slot, wrapping at the end
+	dma_channel_reset(DMA1, DMA_CHANNEL1);
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL1, (uint32_t)&ADC_DR(ADC1));
+	dma_set_memory_address(DMA1, DMA_CHANNEL1, (uint32_t)samples);
+	dma_set_number_of_data(DMA1, DMA_CHANNEL1, count);
+	dma_set_read_from_peripheral(DMA1, DMA_CHANNEL1);
+	dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL1);
+	dma_set_peripheral_size(DMA1, DMA_CHANNEL1, DMA_CCR_PSIZE_16BIT);
+	dma_set_memory_size(DMA1, DMA_CHANNEL1, DMA_CCR_MSIZE_16BIT);
+	dma_enable_circular_mode(DMA1, DMA_CHANNEL1);
+#if INPUT_STATS
+	dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL1); // Timestamp each pass for the latency figures
+	nvic_enable_irq(NVIC_DMA1_CHANNEL1_IRQ);
+#endif
+	dma_enable_channel(DMA1, DMA_CHANNEL1);
+
+	adc_set_regular_sequence(ADC1, 2, channelArray);  // Convert both channels in turn
+	adc_set_continuous_conversion_mode(ADC1);  // Keep converting without being restarted
+	adc_enable_dma_circular_mode(ADC1);  // Keep issuing DMA requests after the first pass
+	adc_enable_dma(ADC1);
+	adc_start_conversion_regular(ADC1);  // Start the continuous conversions
+}
+
+#if INPUT_STATS
+void dma1_channel1_isr(void)
+// Runs at the end of each pass over the joystick sample buffer
+{
+	dma_clear_interrupt_flags(DMA1, DMA_CHANNEL1, DMA_TCIF);
+	joyStickSampled();
+}
+
+uint32_t halReadJoyStickBlocking(int player1Or2)
+// Converts one joystick's channel on its own and waits for the result, as readValueFromJoyStick
+// used to. Only called before halStartJoySticks, while the ADC is idle.
+{
+	uint8_t channelArray[] = {player1Or2 ? 6 : 1};
+	adc_set_regular_sequence(ADC1, 1, channelArray);
+	adc_start_conversion_regular(ADC1);
+	while (!(adc_eoc(ADC1)));
+	return adc_read_regular(ADC1);
+}
+
+static inline uint32_t halLatencyCycles(void)
+{
+	return halCycles();
+}
+#endif
+
+static inline void halDisableInterrupts(void)
+{
+	cm_disable_interrupts();
+}
+
+static inline void halEnableInterrupts(void)
+{
+	cm_enable_interrupts();
+}
+
+void halStartTickTimer(uint32_t hz)
+// Starts SysTick interrupting hz times a second, counting CPU cycles
+{
+	systick_set_clocksource(STK_CSR_CLKSOURCE_AHB);
+	systick_set_reload(rcc_ahb_frequency / hz - 1);
+	systick_clear();
+	systick_interrupt_enable();
+	systick_counter_enable();
+}
+
+void sys_tick_handler(void)
+// Game tick interrupt
+{
+	gameTickDue();
+}
+
+uint32_t halIdle(int (*ready)(void))
+// Sleeps with WFI until an interrupt, and times the sleep on SysTick's counter, which keeps running
+// in Sleep mode. Interrupts are held off across the WFI so the one that wakes the core doesn't
+// run until the sleep has been timed; a pending interrupt still ends WFI.
+// ready, if given, is checked again once interrupts are held off: an interrupt between the caller's
+// test and here may already have done what it was waiting for, and no further one need come soon.
+{
+	uint32_t reload = systick_get_reload() + 1;
+	uint32_t start;
+	uint32_t end;
+	int wasPending;
+	int wrapped;
+
+	cm_disable_interrupts();
+	if (ready && ready())
+	{
+		cm_enable_interrupts();
+		return 0;
+	}
+	start = systick_get_value();
+	wasPending = (SCB_ICSR & SCB_ICSR_PENDSTSET) != 0;
+	__asm__ volatile ("wfi");
+	end = systick_get_value();
+	wrapped = !wasPending && (SCB_ICSR & SCB_ICSR_PENDSTSET); // SysTick counts down and reloads when it fires
+	cm_enable_interrupts();
+
+	return start - end + (wrapped ? reload : 0);
+}
+
+void halStartUsart2(void)
+// Sets USART2 up on PA2 (TX) and PA3 (RX), which the ST-LINK's virtual COM port is wired to.
+// Telemetry and the frame stream share it, so it receives as well only in stream builds.
+{
+	rcc_periph_clock_enable(RCC_GPIOA);
+	rcc_periph_clock_enable(RCC_USART2);
+	rcc_periph_clock_enable(RCC_DMA1);
+
+	gpio_mode_setup(GPIOA, GPIO_MODE_AF, GPIO_PUPD_NONE, GPIO2);
+	gpio_set_af(GPIOA, GPIO_AF7, GPIO2);
+#if STREAM_MODE
+	gpio_mode_setup(GPIOA, GPIO_MODE_AF, GPIO_PUPD_PULLUP, GPIO3); // Idle high if nothing is connected
+	gpio_set_af(GPIOA, GPIO_AF7, GPIO3);
+#endif
+
+	usart_disable(USART2); // Settings only take while it is off, if telemetry started it first
+	usart_set_baudrate(USART2, STREAM_MODE ? STREAM_BAUD : TELEMETRY_BAUD);
+	usart_set_databits(USART2, 8);
+	usart_set_stopbits(USART2, USART_STOPBITS_1);
+	usart_set_parity(USART2, USART_PARITY_NONE);
+	usart_set_flow_control(USART2, USART_FLOWCONTROL_NONE);
+	usart_set_mode(USART2, STREAM_MODE ? USART_MODE_TX_RX : USART_MODE_TX);
+	USART_CR3(USART2) |= USART_CR3_OVRDIS; // Keep receiving after a missed byte; the checksum catches the damage
+	usart_enable(USART2);
+}
+
+void halStartTelemetry(void)
+// Sets USART2 up to transmit on PA2 at TELEMETRY_BAUD, fed by DMA1 channel 7
+{
+	halStartUsart2();
+	usart_enable_tx_dma(USART2);
+
+	dma_channel_reset(DMA1, DMA_CHANNEL7);
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL7, (uint32_t)&USART_TDR(USART2));
+	dma_set_read_from_memory(DMA1, DMA_CHANNEL7);
+	dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL7);
+	dma_set_peripheral_size(DMA1, DMA_CHANNEL7, DMA_CCR_PSIZE_8BIT);
+	dma_set_memory_size(DMA1, DMA_CHANNEL7, DMA_CCR_MSIZE_8BIT);
+}
+
+int halTelemetryBusy(void)
+{
+	return dma_get_number_of_data(DMA1, DMA_CHANNEL7) != 0; // Bytes left to send
+}
+
+void halWriteTelemetry(const uint8_t* data, int length)
+// Starts sending data in the background
+{
+	dma_disable_channel(DMA1, DMA_CHANNEL7);
+	dma_set_memory_address(DMA1, DMA_CHANNEL7, (uint32_t)data);
+	dma_set_number_of_data(DMA1, DMA_CHANNEL7, length);
+	dma_enable_channel(DMA1, DMA_CHANNEL7);
+}
+
+#if STREAM_MODE
+volatile uint32_t streamDmaBytes; // Bytes received up to the last half-ring boundary DMA passed
+uint32_t streamDmaSize;
+
+void halStartStream(uint8_t* ring, int size)
+// Sets USART2 up to receive on PA3 at STREAM_BAUD, with DMA1 channel 6 writing each byte into the
+// ring in turn and wrapping at the end. An interrupt as DMA finishes each half of the ring keeps a
+// running count, so the parser can tell how far behind it is without the CPU touching every byte.
+{
+	halStartUsart2();
+	streamDmaSize = size;
+
+	dma_channel_reset(DMA1, DMA_CHANNEL6);
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL6, (uint32_t)&USART_RDR(USART2));
+	dma_set_memory_address(DMA1, DMA_CHANNEL6, (uint32_t)ring);
+	dma_set_number_of_data(DMA1, DMA_CHANNEL6, size);
+	dma_set_read_from_peripheral(DMA1, DMA_CHANNEL6);
+	dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL6);
+	dma_set_peripheral_size(DMA1, DMA_CHANNEL6, DMA_CCR_PSIZE_8BIT);
+	dma_set_memory_size(DMA1, DMA_CHANNEL6, DMA_CCR_MSIZE_8BIT);
+	dma_set_priority(DMA1, DMA_CHANNEL6, DMA_CCR_PL_HIGH); // Ahead of the joystick samples, which can wait
+	dma_enable_circular_mode(DMA1, DMA_CHANNEL6);
+	dma_enable_half_transfer_interrupt(DMA1, DMA_CHANNEL6);
+	dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL6);
+	nvic_enable_irq(NVIC_DMA1_CHANNEL6_IRQ);
+	dma_enable_channel(DMA1, DMA_CHANNEL6);
+
+	usart_enable_rx_dma(USART2);
+}
+
+void dma1_channel6_isr(void)
+// Counts each half of the stream ring as DMA fills it
+{
+	dma_clear_interrupt_flags(DMA1, DMA_CHANNEL6, DMA_HTIF | DMA_TCIF);
+	streamDmaBytes += streamDmaSize / 2;
+}
+
+uint32_t halStreamReceived(void)
+// Adds how far DMA is into the current half of the ring to the interrupt's count
+{
+	uint32_t base;
+	uint32_t position;
+
+	do
+	{
+		base = streamDmaBytes;
+		position = streamDmaSize - dma_get_number_of_data(DMA1, DMA_CHANNEL6); // Where the next byte will go
+	}
+	while (base != streamDmaBytes); // Read again if a half finished meanwhile
+	return base + (position + streamDmaSize - base % streamDmaSize) % streamDmaSize;
+}
+#endif
+
+#ifdef REPLAY_INCLUDE
+#include REPLAY_INCLUDE // Defines replayData[] and replayDataLength; made by tools/replay_to_c.py
+uint32_t replayPosition; // Bytes of replayData already read
+#endif
+
+int halReadReplay(uint8_t* data, int length)
+// Copies the next bytes of the replay built into flash with -DREPLAY_INCLUDE, if there is one
+{
+#ifdef REPLAY_INCLUDE
+	int i;
+	for (i = 0; i < length && replayPosition < replayDataLength; i++)
+	{
+		data[i] = replayData[replayPosition++];
+	}
+	return i;
+#else
+	(void)data;
+	(void)length;
+	return 0;
+#endif
+}
+
+#else // LEDPANEL_HOST
+
+// Emulated panel state
+uint32_t hostPins; // Current level of each emulated GPIOC pin
+uint32_t hostShiftChain[6 * ROW_WORDS]; // The shift-register chain through every panel; bit 0 of word 0 holds the most recent bit
+struct bitPlane hostPanel; // What each row last latched, i.e. what the panel is showing
+uint32_t hostPinToggles; // Total pin level changes
+uint32_t hostClockPulses; // Rising edges on CLOCK
+uint32_t hostLatches; // Rising edges on LATCH
+
+// Virtual time, in timer ticks of one microsecond
+uint64_t hostMicros;
+uint64_t hostNextInterrupt;
+uint32_t hostTimerPeriod;
+int hostTimerRunning;
+uint64_t hostNextTick; // When the game tick timer fires next
+uint32_t hostTickPeriod;
+int hostTickRunning;
+uint64_t hostRunLimit; // Virtual time at which the emulation stops and reports
+uint32_t hostStartCycles; // Real time the emulation started, for reporting its speed
+
+FILE* hostTelemetry; // Where telemetry records go, if anywhere
+FILE* hostReplay; // Replay being played back, if any
+
+int hostStream = -1; // Where stream bytes come from, if anywhere
+uint8_t* hostStreamRing;
+uint32_t hostStreamSize;
+uint32_t hostStreamBytes; // Bytes written into the ring so far
+uint64_t hostStreamStart; // When the stream started, in virtual time
+
+// Scripted joystick input: lines of "<time in ms> <player 1 value> <player 2 value>"
+FILE* hostJoyStickScript;
+volatile uint16_t* hostJoyStickSamples;
+int hostJoyStickCount;
+uint64_t hostNextJoyStickTime;
+uint16_t hostNextJoyStickValue[2];
+
+uint32_t hostReverseBits(uint32_t value)
+// Reverses the bit order of a word
+{
+	uint32_t result = 0;
+	int i;
+	for (i = 0; i < 32; i++)
+	{
+		result = (result << 1) | (value & 1);
+		value >>= 1;
+	}
+	return result;
+}
+
+void hostLatchRow(void)
+// Copies the shift-register chain into the addressed row pair, as the panels do on a latch.
+// Each panel holds 6 * PANEL_WIDTH bits: blue, green and red of the lower row, then the same for
+// the upper row. The first bit shifted in has moved furthest down the chain, to the leftmost panel.
+{
+	int row = 0;
+	int last = 6 * ROW_WORDS - 1; // Chain word holding the first bits shifted in
+	int i;
+	int panel;
+	int w;
+
+	for (i = 5 - ROW_ADDRESS_BITS; i < 5; i++) // ROWSELECT[] runs from the most significant address bit
+	{
+		row = (row << 1) | ((hostPins & ROWSELECT[i]) ? 1 : 0);
+	}
+
+	for (panel = 0; panel < PANEL_CHAIN; panel++)
+	{
+		for (w = 0; w < PANEL_WORDS; w++)
+		{
+			int word = panel * PANEL_WORDS + w;
+			int base = last - panel * 6 * PANEL_WORDS - w; // Chain word holding this panel's first blue bits
+			hostPanel.blue[row + SCAN_ROWS][word] = hostReverseBits(hostShiftChain[base]);
+			hostPanel.green[row + SCAN_ROWS][word] = hostReverseBits(hostShiftChain[base - PANEL_WORDS]);
+			hostPanel.red[row + SCAN_ROWS][word] = hostReverseBits(hostShiftChain[base - 2 * PANEL_WORDS]);
+			hostPanel.blue[row][word] = hostReverseBits(hostShiftChain[base - 3 * PANEL_WORDS]);
+			hostPanel.green[row][word] = hostReverseBits(hostShiftChain[base - 4 * PANEL_WORDS]);
+			hostPanel.red[row][word] = hostReverseBits(hostShiftChain[base - 5 * PANEL_WORDS]);
+		}
+	}
+	hostLatches++;
+}
+
+void hostUpdatePins(uint32_t pins)
+// Applies new pin levels, clocking the shift registers and latching rows on rising edges
+{
+	uint32_t rising = pins & ~hostPins;
+	int i;
+
+	hostPinToggles += __builtin_popcount(pins ^ hostPins);
+	hostPins = pins;
+
+	if (rising & CLOCK)
+	{
+		for (i = 6 * ROW_WORDS - 1; i > 0; i--)
+		{
+			hostShiftChain[i] = (hostShiftChain[i] << 1) | (hostShiftChain[i - 1] >> 31);
+		}
+		hostShiftChain[0] = (hostShiftChain[0] << 1) | ((pins & INPUTSIGNAL) ? 1 : 0);
+		hostClockPulses++;
+	}
+	if (rising & LATCH)
+	{
+		hostLatchRow();
+	}
+}
+
+static inline void halWritePins(uint32_t pattern)
+{
+	hostUpdatePins((hostPins & ~(pattern >> 16)) | (pattern & 0xFFFF)); // Set wins over reset, as on the STM32
+}
+
+static inline void halSetPins(uint32_t pins)
+{
+	hostUpdatePins(hostPins | pins);
+}
+
+static inline void halClearPins(uint32_t pins)
+{
+	hostUpdatePins(hostPins & ~pins);
+}
+
+void hostReport(void)
+// Prints the emulated panel and pin statistics, then ends the run
+{
+	int x;
+	int y;
+	const char colourNames[] = ".RGYBMCW"; // Indexed by blue << 2 | green << 1 | red
+
+	for (y = 0; y < DISPLAY_HEIGHT; y++)
+	{
+		for (x = 0; x < DISPLAY_WIDTH; x++)
+		{
+			int w = x / 32;
+			int bit = x % 32;
+			int colour = ((hostPanel.red[y][w] >> bit) & 1) | (((hostPanel.green[y][w] >> bit) & 1) << 1) | (((hostPanel.blue[y][w] >> bit) & 1) << 2);
+			putchar(colourNames[colour]);
+		}
+		putchar('\n');
+	}
+	printf("panel time %llu us, latches %u, clock pulses %u, pin toggles %u (%u per latch)\n",
+		(unsigned long long)hostMicros, hostLatches, hostClockPulses, hostPinToggles,
+		hostLatches ? hostPinToggles / hostLatches : 0);
+	printf("panel refresh rate %llu Hz, emulated in %u us of host time\n",
+		hostLatches * 1000000ull / (SCAN_ROWS * COLOUR_DEPTH) / (hostMicros ? hostMicros : 1),
+		(halCycles() - hostStartCycles) / 1000);
+	printf("game ticks %u, missed deadlines %u, dropped %u, idle %u%% of virtual time\n",
+		schedulerStats.ticksRun, schedulerStats.missedDeadlines, schedulerStats.droppedTicks, schedulerStats.idlePercent);
+	if (renderStats.frames)
+	{
+		printf("render: %u frames, %.1f rows redrawn and %.0f pixels touched per frame\n", renderStats.frames,
+			(double)renderStats.totalRowsRedrawn / renderStats.frames, (double)renderStats.totalPixelsTouched / renderStats.frames);
+	}
+#if INPUT_STATS
+	printf("input: %u reads, %.0f ns each (%.0f ns blocking), %u passes, latency %.0f us average, %.0f us worst over %u changes\n",
+		inputStats.reads, inputStats.reads ? (double)inputStats.readCycles / inputStats.reads : 0.0,
+		inputStats.blockingReads ? (double)inputStats.blockingCycles / inputStats.blockingReads : 0.0, inputStats.ringPasses,
+		inputStats.latencies ? inputStats.latencyCycles / 1e3 / inputStats.latencies : 0.0, inputStats.maxLatencyCycles / 1e3, inputStats.latencies);
+#endif
+#if SHIFT_STATS
+	printf("shift: %u rows, %.1f GPIO register writes and %.0f ns of host time per row\n", shiftStats.rowsShifted,
+		shiftStats.rowsShifted ? (double)shiftStats.registerWrites / shiftStats.rowsShifted : 0.0,
+		shiftStats.rowsShifted ? (double)shiftStats.cycles / shiftStats.rowsShifted : 0.0);
+#endif
+#if TEXT_STATS
+	printf("text: %u glyphs in %u us of host time, %.0f glyphs per ms\n", textStats.glyphsDrawn, textStats.cycles / 1000,
+		textStats.cycles ? textStats.glyphsDrawn * 1e6 / textStats.cycles : 0.0);
+#endif
+#if STREAM_MODE
+	printf("stream at %d baud: %u frames shown (%u full, %u delta), %.1f frames/s, %u dropped, %u torn, %u overruns, %u bytes\n",
+		STREAM_BAUD, streamStats.framesShown, streamStats.fullFrames, streamStats.deltaFrames,
+		hostMicros > hostStreamStart ? streamStats.framesShown * 1e6 / (hostMicros - hostStreamStart) : 0.0,
+		streamStats.droppedFrames, streamStats.tornFrames, streamStats.overruns, streamStats.bytes);
+#endif
+	exit(0);
+}
+
+void hostApplyJoyStickScript(void)
+// Copies any scripted joystick values that are due into every sample slot, as if DMA had sampled them
+{
+	int i;
+	unsigned long long time;
+	unsigned int value1;
+	unsigned int value2;
+	char line[128];
+
+	while (hostNextJoyStickTime <= hostMicros)
+	{
+		for (i = 0; i < hostJoyStickCount; i++)
+		{
+			hostJoyStickSamples[i] = hostNextJoyStickValue[i & 1];
+		}
+#if INPUT_STATS
+		if (hostJoyStickSamples) joyStickSampled(); // The whole buffer was rewritten, as by one DMA pass
+#endif
+
+		hostNextJoyStickTime = UINT64_MAX; // Nothing more unless another line is found
+		while (hostJoyStickScript && fgets(line, sizeof line, hostJoyStickScript))
+		{
+			if (sscanf(line, "%llu %u %u", &time, &value1, &value2) == 3) // Skips blank and comment lines
+			{
+				hostNextJoyStickTime = time * 1000;
+				hostNextJoyStickValue[0] = value1;
+				hostNextJoyStickValue[1] = value2;
+				break;
+			}
+		}
+	}
+}
+
+uint64_t hostNextEvent(void)
+// Returns when the next timer interrupt is due, or UINT64_MAX if no timer is running
+{
+	uint64_t next = UINT64_MAX;
+	if (hostTimerRunning) next = hostNextInterrupt;
+	if (hostTickRunning && hostNextTick < next) next = hostNextTick;
+	return next;
+}
+
+void hostRunUntil(uint64_t time)
+// Advances virtual time, running the scan and game tick timer interrupts whenever they are due
+{
+	while (hostNextEvent() <= time)
+	{
+		hostMicros = hostNextEvent();
+		hostApplyJoyStickScript();
+		if (hostTimerRunning && hostNextInterrupt == hostMicros)
+		{
+			hostNextInterrupt += hostTimerPeriod;
+			scanNextRow();
+		}
+		else
+		{
+			hostNextTick += hostTickPeriod;
+			gameTickDue();
+		}
+	}
+	hostMicros = time;
+	hostApplyJoyStickScript();
+
+	if (hostMicros >= hostRunLimit) hostReport();
+}
+
+void halInit(void)
+// Reads the emulation settings from the environment:
+// LEDPANEL_RUN_MS sets how much panel time to emulate before reporting (default 5000)
+// LEDPANEL_JOYSTICK_SCRIPT names a joystick script file (default: both sticks centred)
+// LEDPANEL_REPLAY names a replay file to play back before handing over to the joysticks
+{
+	const char* runMs = getenv("LEDPANEL_RUN_MS");
+	hostRunLimit = (runMs ? strtoull(runMs, NULL, 10) : 5000) * 1000;
+	hostStartCycles = halCycles();
+
+	hostNextJoyStickValue[0] = 2048; // Centred
+	hostNextJoyStickValue[1] = 2048;
+	hostNextJoyStickTime = 0;
+
+	const char* script = getenv("LEDPANEL_JOYSTICK_SCRIPT");
+	if (script)
+	{
+		hostJoyStickScript = fopen(script, "r");
+		if (!hostJoyStickScript)
+		{
+			perror(script);
+			exit(1);
+		}
+	}
+
+	const char* replay = getenv("LEDPANEL_REPLAY");
+	if (replay)
+	{
+		hostReplay = fopen(replay, "rb");
+		if (!hostReplay)
+		{
+			perror(replay);
+			exit(1);
+		}
+	}
+}
+
+void halStartRowTimer(uint32_t ticks)
+{
+	hostTimerPeriod = ticks;
+	hostNextInterrupt = hostMicros + ticks;
+	hostTimerRunning = 1;
+}
+
+static inline void halSetRowTimerPeriod(uint32_t ticks)
+{
+	hostTimerPeriod = ticks;
+	hostNextInterrupt = hostMicros + ticks;
+}
+
+uint32_t halTimerFrequency(void)
+{
+	return 1000000; // Virtual timer ticks are microseconds
+}
+
+static inline uint32_t halCycles(void)
+// Host time in nanoseconds, standing in for the cycle counter
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t)(now.tv_sec * 1000000000ull + now.tv_nsec);
+}
+
+uint32_t halCyclesPerSecond(void)
+{
+	return 1000000000;
+}
+
+void halStartJoySticks(volatile uint16_t* samples, int count)
+{
+	hostJoyStickSamples = samples;
+	hostJoyStickCount = count;
+	hostApplyJoyStickScript();
+}
+
+#if INPUT_STATS
+uint32_t halReadJoyStickBlocking(int player1Or2)
+{
+	return hostNextJoyStickValue[player1Or2]; // There is no conversion to wait for
+}
+
+static inline uint32_t halLatencyCycles(void)
+// Virtual time in nanoseconds: the wait for the game tick is skipped in real time
+{
+	return (uint32_t)(hostMicros * 1000);
+}
+#endif
+
+static inline void halDisableInterrupts(void)
+// Host interrupts only run inside hostRunUntil, so nothing can preempt the caller
+{
+}
+
+static inline void halEnableInterrupts(void)
+{
+}
+
+void halStartTickTimer(uint32_t hz)
+{
+	hostTickPeriod = 1000000 / hz;
+	hostNextTick = hostMicros + hostTickPeriod;
+	hostTickRunning = 1;
+}
+
+uint32_t halIdle(int (*ready)(void))
+// Nothing else can happen until the next timer interrupt, so skip straight to it.
+// Returns the virtual time skipped, in the nanoseconds halCycles counts.
+{
+	uint64_t start = hostMicros;
+	uint64_t next = hostNextEvent();
+
+	if (ready && ready()) return 0;
+
+	hostRunUntil(next != UINT64_MAX ? next : hostMicros + 1000);
+	return (uint32_t)(hostMicros - start) * 1000;
+}
+
+void halStartTelemetry(void)
+// Telemetry is appended to the file or pipe named by LEDPANEL_TELEMETRY
+{
+	const char* path = getenv("LEDPANEL_TELEMETRY");
+	if (path)
+	{
+		hostTelemetry = fopen(path, "ab");
+		if (!hostTelemetry)
+		{
+			perror(path);
+			exit(1);
+		}
+	}
+}
+
+int halTelemetryBusy(void)
+{
+	return 0; // Writes complete immediately
+}
+
+void halWriteTelemetry(const uint8_t* data, int length)
+{
+	if (hostTelemetry)
+	{
+		fwrite(data, 1, length, hostTelemetry);
+		fflush(hostTelemetry);
+	}
+}
+
+int halReadReplay(uint8_t* data, int length)
+{
+	return hostReplay ? (int)fread(data, 1, length, hostReplay) : 0;
+}
+
+#if STREAM_MODE
+void halStartStream(uint8_t* ring, int size)
+// Stream bytes are read from the file, FIFO or pty named by LEDPANEL_STREAM
+{
+	const char* path = getenv("LEDPANEL_STREAM");
+
+	hostStreamRing = ring;
+	hostStreamSize = size;
+	hostStreamStart = hostMicros;
+	if (path)
+	{
+		hostStream = open(path, O_RDONLY | O_NONBLOCK); // Never wait for a writer, as DMA wouldn't
+		if (hostStream < 0)
+		{
+			perror(path);
+			exit(1);
+		}
+	}
+}
+
+uint32_t halStreamReceived(void)
+// Writes whatever the link could have carried by now into the ring, as DMA would: STREAM_BAUD
+// bits a second of virtual time, ten to a byte with the start and stop bits, overwriting unread bytes
+{
+	uint64_t due = (hostMicros - hostStreamStart) * (STREAM_BAUD / 10) / 1000000;
+
+	while (hostStream >= 0 && hostStreamBytes < due)
+	{
+		uint32_t at = hostStreamBytes % hostStreamSize;
+		uint32_t length = hostStreamSize - at; // Up to the end of the ring
+		if (length > due - hostStreamBytes) length = due - hostStreamBytes;
+
+		ssize_t got = read(hostStream, hostStreamRing + at, length);
+		if (got <= 0) break; // Nothing more yet, or the end of a file
+		hostStreamBytes += got;
+	}
+	return hostStreamBytes;
+}
+#endif
+
+#endif // LEDPANEL_HOST
+
+void moveBallVertical(struct gameInfo* ballInfo)
+// Handles vertical movement of the ball
+{
+	if (ballInfo->ballYDirection) // If ball is moving up
+	{
+		if ((ballInfo->ballYCoordinate) != 0) // If ball is not at the top
+		{
+			ballInfo->ballYCoordinate -= 1; // Move ball up
+		}
+		else
+		{ 
+			ballInfo->ballYDirection =  0; // Change y-direction to moving down
+			ballInfo->ballYCoordinate += 1; // Move ball down
+		}
+	}
+	else // Ball is moving down
+	{
+		if ((ballInfo->ballYCoordinate) != DISPLAY_HEIGHT - 1) // If ball is not at the bottom
+		{
+			ballInfo->ballYCoordinate += 1; // Move ball down
+		}
+		else
+		{ 
+			ballInfo->ballYDirection =  1; // Change y-direction to moving up
+			ballInfo->ballYCoordinate -= 1; // Move ball up
+		}
+	} 
+}
+
+void moveBallHorizontal(struct gameInfo* ballInfo)
+// Handles horizontal movement of the ball including interaction with paddles
+{
+	if(ballInfo->ballXDirection) // If ball is moving right
+	{
+		if((ballInfo->ballXCoordinate) < DISPLAY_WIDTH - 2) // If ball is not next to the right-hand paddle
+		{
+			ballInfo->ballXCoordinate += 1; // Move ball right 
+		}
+		else if ((ballInfo->ballXCoordinate) == DISPLAY_WIDTH - 2)  // If ball is vertically aligned with the right-hand paddle
+		{	
+			if (paddleExists(ballInfo->ballYCoordinate, ballInfo->paddle2Position, PADDLELENGTH)) // If the right-hand paddle hits the ball
+			{ // bounce the ball off the paddle
+				ballInfo->ballXDirection = 0; // Change x-direction to moving left
+				ballInfo->ballXCoordinate -= 1; // Move ball left 
+			} 
+			else
+			{	
+				ballInfo->ballXCoordinate += 1; // Ball continues moving right
+			}
+		}
+		else // Reset ball position after missing the paddle
+		{
+			ballInfo->score1 += 1; // Player 1 scores
+			ballInfo->ballXDirection = 0; // Change x-direction to moving left
+			ballInfo->ballXCoordinate = DISPLAY_WIDTH / 2 - 1; // Re-centre ball	
+		}
+	}
+	
+	else // If ball is moving left
+	{
+		if((ballInfo->ballXCoordinate) > 1) // If ball is not next to the left-hand paddle
+		{
+			ballInfo->ballXCoordinate -= 1; // Move ball left
+		}
+
+		else if (ballInfo->ballXCoordinate == 1) // If ball is vertically aligned with the left-hand paddle
+		{	
+			if (paddleExists(ballInfo->ballYCoordinate ,ballInfo->paddle1Position, PADDLELENGTH)) // If the left-hand paddle hits the ball
+			{ // bounce the ball off the paddle
+				ballInfo->ballXDirection =  1; // Change x-direction to moving right
+				ballInfo->ballXCoordinate += 1; // Move ball right
+			} 
+			else
+			{	
+				ballInfo->ballXCoordinate -= 1; // Ball continues moving left
+			}
+		}
+		else // Reset ball position after missing the paddle
+		{
+			ballInfo->score2 += 1; // Player 2 scores
+			ballInfo->ballXDirection = 1; // Change x-direction to moving right
+			ballInfo->ballXCoordinate = DISPLAY_WIDTH / 2 - 1; // Re-centre ball
+		}
+	}
+}
+
+void movePaddle(int player1or2,struct gameInfo* paddleInfo, int direction) // false if p1, true if p2
+// Moves the paddle of the specified player up (direction 1) or down (direction -1)
+{
+	int* paddleStartLocation;
+
+	// Determine which paddle's position (use as paddle start location) to modify based on the player
+	if (!player1or2) paddleStartLocation = &(paddleInfo->paddle1Position); 
+	else paddleStartLocation = &(paddleInfo->paddle2Position); 
+
+	// Check if the joystick indicates upward movement and the paddle isn't at the top edge
+	if (direction == 1 && (*paddleStartLocation != 0)) 
+	{
+		*paddleStartLocation -= 1; // Move paddle up
+	}
+	    // Check if the joystick indicates downward movement and the paddle isn't at the bottom edge
+	else if (direction == -1 && (*paddleStartLocation != DISPLAY_HEIGHT - 1 - PADDLELENGTH)) // // if joystick moved down and paddle start location is not at the bottom, move paddle down
+	{
+		*paddleStartLocation += 1; // Move paddle down
+	}
+}
+
+int paddleExists(int ballYposition, int paddlePosition, int length)
+// Checks if the ball's vertical position overlaps with the paddle's vertical range
+	{
+		if (ballYposition >= paddlePosition && ballYposition <= (paddlePosition + length)) return 1; // if ball is within the vertical range of the paddle
+		else return 0;
+	}
+
+uint8_t packInput(int direction1, int direction2)
+// Packs both players' directions (1 up, -1 down, 0 still) into one byte of a replay:
+// bits 0-1 are player 1 and bits 2-3 player 2, with 1 meaning up and 2 meaning down
+{
+	int code1 = direction1 == 1 ? 1 : direction1 == -1 ? 2 : 0;
+	int code2 = direction2 == 1 ? 1 : direction2 == -1 ? 2 : 0;
+	return code1 | (code2 << 2);
+}
+
+int inputDirection(uint8_t input, int player1Or2)
+// Unpacks one player's direction from a byte made by packInput
+{
+	int code = (input >> (2 * player1Or2)) & 3;
+	return code == 1 ? 1 : code == 2 ? -1 : 0;
+}
+
+void stepGame(struct gameInfo* game, uint8_t input)
+// Advances the game by one tick: the ball moves, then each paddle moves as input says.
+// Takes no time and touches no hardware, so replays and the simulator can call it directly.
+{
+	moveBallVertical(game);
+	moveBallHorizontal(game);
+	movePaddle(0, game, inputDirection(input, 0));
+	movePaddle(1, game, inputDirection(input, 1));
+}
+
+void putU16(uint8_t* out, uint32_t value)
+{
+	out[0] = value;
+	out[1] = value >> 8;
+}
+
+void putU32(uint8_t* out, uint32_t value)
+{
+	putU16(out, value);
+	putU16(out + 2, value >> 16);
+}
+
+uint16_t getU16(const uint8_t* in)
+{
+	return in[0] | (in[1] << 8);
+}
+
+uint32_t getU32(const uint8_t* in)
+{
+	return getU16(in) | ((uint32_t)getU16(in + 2) << 16);
+}
+
+uint32_t parseReplayHeader(const uint8_t* header, struct gameInfo* game)
+// Checks a replay header matches this build's display and fills in the starting game state.
+// Returns the number of ticks of input that follow, or 0 if the replay can't be used.
+//
+// Header: u16 magic, u8 version, u8 paddle length, u16 display width, u16 display height,
+//         u32 ticks, then i16 paddle1Position, paddle2Position, ballXCoordinate, ballYCoordinate,
+//         ballXDirection, ballYDirection
+{
+	if (getU16(header) != REPLAY_MAGIC || header[2] != REPLAY_VERSION || header[3] != PADDLELENGTH
+		|| getU16(header + 4) != DISPLAY_WIDTH || getU16(header + 6) != DISPLAY_HEIGHT) return 0;
+
+	game->paddle1Position = (int16_t)getU16(header + 12);
+	game->paddle2Position = (int16_t)getU16(header + 14);
+	game->ballXCoordinate = (int16_t)getU16(header + 16);
+	game->ballYCoordinate = (int16_t)getU16(header + 18);
+	game->ballXDirection = (int16_t)getU16(header + 20);
+	game->ballYDirection = (int16_t)getU16(header + 22);
+	game->score1 = 0; // Replays start from 0-0
+	game->score2 = 0;
+	return getU32(header + 8);
+}
+
+uint32_t loadReplay(struct gameInfo* game)
+// Starts playing back the replay the HAL provides, if there is one that fits this display.
+// Returns the number of ticks of input to read with halReadReplay, or 0 to use the joysticks.
+{
+	uint8_t header[REPLAY_HEADER_SIZE];
+
+	if (halReadReplay(header, REPLAY_HEADER_SIZE) != REPLAY_HEADER_SIZE) return 0;
+	return parseReplayHeader(header, game);
+}
+
+static inline uint32_t randomNext(uint32_t state)
+// One step of a xorshift generator; state must not be 0
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+int predictBall(const struct ballState* ball, int player1Or2, int* ticks)
+// Works out, without stepping the game, the row moveBallHorizontal will next test against a player's
+// paddle: player 1's at column 1 heading left, player 2's at column DISPLAY_WIDTH - 2 heading right.
+// Sets *ticks to the number of stepGame calls up to and including the one making that test.
+// If the ball has to reach the other paddle first, it is assumed to be returned.
+//
+// The ball moves one column and one row every tick. Horizontally, the ticks are just the distance
+// along its path: straight to the column, via the other paddle, or via the centre after a miss.
+// Vertically, bouncing off rows 0 and DISPLAY_HEIGHT - 1 makes its row a triangle wave with a
+// period of 2 * (DISPLAY_HEIGHT - 1) ticks. Any tick's row is then one modulo away, so this
+// takes the same time however far ahead the ball is going.
+{
+	int x = ball->ballXCoordinate;
+	int centre = DISPLAY_WIDTH / 2 - 1; // Where moveBallHorizontal puts the ball after a miss
+	int across = DISPLAY_WIDTH - 3; // Ticks from one paddle's return to reaching the other paddle's column
+	int period = 2 * (DISPLAY_HEIGHT - 1);
+	int phase;
+
+	if (!player1Or2)
+	{
+		if (!ball->ballXDirection) *ticks = x >= 1 ? x : 1 + (DISPLAY_WIDTH - 1 - centre) + across;
+		else *ticks = x <= DISPLAY_WIDTH - 2 ? (DISPLAY_WIDTH - 1 - x) + across : 1 + centre;
+	}
+	else
+	{
+		if (ball->ballXDirection) *ticks = x <= DISPLAY_WIDTH - 2 ? DISPLAY_WIDTH - 1 - x : 1 + centre + across;
+		else *ticks = x >= 1 ? x + across : 1 + (DISPLAY_WIDTH - 1 - centre);
+	}
+
+	// Position in the bounce cycle: going down from row 0 for the first half, back up for the second
+	phase = ball->ballYDirection ? period - ball->ballYCoordinate : ball->ballYCoordinate;
+	phase = (phase + *ticks) % period;
+	return phase < DISPLAY_HEIGHT ? phase : period - phase;
+}
+
+int cpuDirection(const struct gameInfo* game, int player1Or2)
+// Chooses a CPU paddle's move for this tick (1 up, -1 down, 0 still): towards where it expects the
+// ball, judged from where the ball was CPU_REACTION_TICKS ago and off by up to CPU_ERROR_ROWS rows
+{
+	struct cpuPlayer* cpu = &cpuPlayers[player1Or2];
+	const struct ballState* seen = &cpuHistory[(cpuTicks - CPU_REACTION_TICKS) % CPU_HISTORY];
+	int position = player1Or2 ? game->paddle2Position : game->paddle1Position;
+	int ticks;
+	int target;
+
+	if (seen->ballXDirection != cpu->lastXDirection) // A new approach: misjudge it afresh
+	{
+		cpu->random = randomNext(cpu->random);
+		cpu->error = (int)(cpu->random % (2 * CPU_ERROR_ROWS + 1)) - CPU_ERROR_ROWS;
+		cpu->lastXDirection = seen->ballXDirection;
+	}
+
+	target = predictBall(seen, player1Or2, &ticks) + cpu->error - PADDLELENGTH / 2; // Paddle position centring it there
+	return (target < position) - (target > position);
+}
+
+uint8_t cpuInput(const struct gameInfo* game, uint8_t input, int players)
+// Remembers where the ball is this tick, then replaces the directions in input of the paddles the
+// CPU plays with its own moves. players picks the paddles as CPU_PLAYERS does.
+{
+	struct ballState now = {game->ballXCoordinate, game->ballYCoordinate, game->ballXDirection, game->ballYDirection};
+	int direction1 = inputDirection(input, 0);
+	int direction2 = inputDirection(input, 1);
+	int i;
+
+	if (!cpuTicks) // Nothing earlier has been seen, so act on the first sighting until the delay has passed
+	{
+		for (i = 0; i < CPU_HISTORY; i++) cpuHistory[i] = now;
+	}
+	cpuHistory[cpuTicks % CPU_HISTORY] = now;
+
+	if (players & 1) direction1 = cpuDirection(game, 0);
+	if (players & 2) direction2 = cpuDirection(game, 1);
+	cpuTicks++;
+	return packInput(direction1, direction2);
+}
+
+rowMask rowSpanMask(int top, int length)
+// Returns a mask with one bit set for each of the rows top to top + length - 1
+{
+	if (length >= ROWMASK_BITS) return ~(rowMask)0;
+	return (((rowMask)1 << length) - 1) << top;
+}
+
+void drawColumnRows(struct frameBuffer* screen, int column, rowMask rows, struct pixel colour)
+// Paints one column of every row set in the rows mask in one colour, overwriting whatever was there before.
+// Each row only needs its column bit masked into every colour plane.
+{
+	int b;
+	int w = column / 32; // Word holding this column in every row
+	uint32_t mask = (uint32_t)1 << (column % 32); // Bit for this column in that word
+
+	for (b = 0; b < COLOUR_DEPTH; b++)
+	{
+		struct bitPlane* plane = &screen->plane[b];
+		rowMask remaining = rows;
+
+		// Work out this plane's bits once, rather than testing the colour on every row
+		uint32_t redBits = (colour.red >> b) & 1 ? mask : 0;
+		uint32_t greenBits = (colour.green >> b) & 1 ? mask : 0;
+		uint32_t blueBits = (colour.blue >> b) & 1 ? mask : 0;
+
+		while (remaining)
+		{
+			int i = ROWMASK_CTZ(remaining); // Lowest row still to draw
+			remaining &= remaining - 1;
+
+			plane->red[i][w] = (plane->red[i][w] & ~mask) | redBits;
+			plane->green[i][w] = (plane->green[i][w] & ~mask) | greenBits;
+			plane->blue[i][w] = (plane->blue[i][w] & ~mask) | blueBits;
+		}
+	}
+}
+
+void drawColumnSpan(struct frameBuffer* screen, int column, int top, int length, struct pixel colour)
+// Paints a vertical run of pixels in one colour, overwriting whatever was there before.
+{
+	drawColumnRows(screen, column, rowSpanMask(top, length), colour);
+}
+
+void drawPaddlesToScreen(struct frameBuffer* screen, int paddle1Position, int paddle2Position)
+// Draws both paddles onto the screen: player 1's red paddle on the left and player 2's blue paddle on the right
+{	
+	drawColumnSpan(screen, 0, paddle1Position, PADDLELENGTH, red); // Draw player 1's paddle red
+	drawColumnSpan(screen, DISPLAY_WIDTH - 1, paddle2Position, PADDLELENGTH, blue); // Draw player 2's paddle blue
+}
+
+void drawBallToScreen(struct frameBuffer* screen, int ballXPosition, int ballYPosition)
+// Draws the ball at its current position on the screen in white
+{
+	drawColumnSpan(screen, ballXPosition, ballYPosition, 1, white); 
+} 
+
+void clearRows(struct frameBuffer* screen, rowMask rows)
+// Blanks every row set in the rows mask, one word store per 32 columns per colour plane
+{
+	int b;
+	int w;
+	for (b = 0; b < COLOUR_DEPTH; b++)
+	{
+		rowMask remaining = rows;
+		while (remaining)
+		{
+			int i = ROWMASK_CTZ(remaining);
+			remaining &= remaining - 1;
+
+			for (w = 0; w < ROW_WORDS; w++)
+			{
+				screen->plane[b].red[i][w] = 0;
+				screen->plane[b].green[i][w] = 0;
+				screen->plane[b].blue[i][w] = 0;
+			}
+		}
+	}
+}
+
+// Generated by tools/font_convert.py from art/font3x5.txt
+const uint8_t font3x5Rows[] = // 320 bytes
+{
+	0x00,0x00,0x00,0x00,0x00, // space
+	0x02,0x02,0x02,0x00,0x02, // !
+	0x05,0x05,0x00,0x00,0x00, // "
+	0x05,0x07,0x05,0x07,0x05, // #
+	0x06,0x03,0x02,0x06,0x03, // $
+	0x01,0x04,0x02,0x01,0x04, // %
+	0x02,0x05,0x02,0x05,0x06, // &
+	0x02,0x02,0x00,0x00,0x00, // '
+	0x04,0x02,0x02,0x02,0x04, // (
+	0x01,0x02,0x02,0x02,0x01, // )
+	0x00,0x05,0x02,0x05,0x00, // *
+	0x00,0x02,0x07,0x02,0x00, // +
+	0x00,0x00,0x00,0x02,0x01, // ,
+	0x00,0x00,0x07,0x00,0x00, // -
+	0x00,0x00,0x00,0x00,0x02, // .
+	0x04,0x04,0x02,0x01,0x01, // /
+	0x07,0x05,0x05,0x05,0x07, // 0
+	0x02,0x03,0x02,0x02,0x07, // 1
+	0x07,0x04,0x07,0x01,0x07, // 2
+	0x07,0x04,0x06,0x04,0x07, // 3
+	0x05,0x05,0x07,0x04,0x04, // 4
+	0x07,0x01,0x07,0x04,0x07, // 5
+	0x07,0x01,0x07,0x05,0x07, // 6
+	0x07,0x04,0x04,0x02,0x02, // 7
+	0x07,0x05,0x07,0x05,0x07, // 8
+	0x07,0x05,0x07,0x04,0x07, // 9
+	0x00,0x02,0x00,0x02,0x00, // :
+	0x00,0x02,0x00,0x02,0x01, // ;
+	0x04,0x02,0x01,0x02,0x04, // <
+	0x00,0x07,0x00,0x07,0x00, // =
+	0x01,0x02,0x04,0x02,0x01, // >
+	0x07,0x04,0x06,0x00,0x02, // ?
+	0x07,0x05,0x03,0x01,0x06, // @
+	0x02,0x05,0x07,0x05,0x05, // A
+	0x03,0x05,0x03,0x05,0x03, // B
+	0x06,0x01,0x01,0x01,0x06, // C
+	0x03,0x05,0x05,0x05,0x03, // D
+	0x07,0x01,0x03,0x01,0x07, // E
+	0x07,0x01,0x03,0x01,0x01, // F
+	0x06,0x01,0x05,0x05,0x06, // G
+	0x05,0x05,0x07,0x05,0x05, // H
+	0x07,0x02,0x02,0x02,0x07, // I
+	0x04,0x04,0x04,0x05,0x02, // J
+	0x05,0x05,0x03,0x05,0x05, // K
+	0x01,0x01,0x01,0x01,0x07, // L
+	0x05,0x07,0x07,0x05,0x05, // M
+	0x03,0x05,0x05,0x05,0x05, // N
+	0x02,0x05,0x05,0x05,0x02, // O
+	0x03,0x05,0x03,0x01,0x01, // P
+	0x02,0x05,0x05,0x03,0x06, // Q
+	0x03,0x05,0x03,0x05,0x05, // R
+	0x06,0x01,0x02,0x04,0x03, // S
+	0x07,0x02,0x02,0x02,0x02, // T
+	0x05,0x05,0x05,0x05,0x07, // U
+	0x05,0x05,0x05,0x05,0x02, // V
+	0x05,0x05,0x07,0x07,0x05, // W
+	0x05,0x05,0x02,0x05,0x05, // X
+	0x05,0x05,0x02,0x02,0x02, // Y
+	0x07,0x04,0x02,0x01,0x07, // Z
+	0x03,0x01,0x01,0x01,0x03, // [
+	0x01,0x01,0x02,0x04,0x04, // backslash
+	0x06,0x04,0x04,0x04,0x06, // ]
+	0x02,0x05,0x00,0x00,0x00, // ^
+	0x00,0x00,0x00,0x00,0x07, // _
+};
+
+const struct font font3x5 = {3, 5, 32, 64, font3x5Rows};
+
+int textWidth(const struct font* font, int length)
+// Returns how many columns a string of length characters covers
+{
+	return length ? length * (font->width + 1) - 1 : 0;
+}
+
+int drawText(struct frameBuffer* screen, const struct font* font, int x, int y, const char* text, struct pixel colour)
+// Draws a string with its top-left corner at (x, y), lighting only the glyphs' pixels so whatever is
+// underneath shows between them. Anything off the display is clipped. Characters the font lacks are
+// drawn as its first glyph, and lower case as upper case. Returns the number of pixels drawn.
+// Glyph rows are shifted into place and ORed into one mask per row word, then each word is written
+// with one mask operation per colour plane, rather than pixel by pixel.
+{
+#if TEXT_STATS
+	uint32_t startCycles = halCycles();
+#endif
+	uint32_t rows[8][ROW_WORDS]; // Lit pixels in each row the text covers
+	int pixels = 0;
+	int advance = font->width + 1;
+	int length = strlen(text);
+	int first = x < 0 ? (1 - x) / advance : 0; // First character not entirely left of the display
+	int last = (DISPLAY_WIDTH - 1 - x) / advance; // Last character starting on the display
+	int row;
+	int w;
+	int b;
+	int i;
+
+	if (x >= DISPLAY_WIDTH || y >= DISPLAY_HEIGHT || y <= -font->height) return 0; // Entirely off the display
+	if (last >= length) last = length - 1;
+	memset(rows, 0, font->height * sizeof rows[0]);
+
+	for (i = first; i <= last; i++)
+	{
+		int code = text[i];
+		if (code >= 'a' && code <= 'z') code -= 'a' - 'A';
+		code -= font->first;
+		if (code < 0 || code >= font->count) code = 0;
+
+		const uint8_t* glyph = font->rows + code * font->height;
+		int left = x + i * advance;
+		int word = (left + 32) / 32 - 1; // Row word holding the glyph's left edge, -1 if it starts left of the display
+		int shift = left - 32 * word;
+
+		for (row = 0; row < font->height; row++)
+		{
+			uint64_t bits = (uint64_t)glyph[row] << shift; // Straddles at most two words
+			if (word >= 0) rows[row][word] |= (uint32_t)bits;
+			if (word + 1 < ROW_WORDS) rows[row][word + 1] |= (uint32_t)(bits >> 32);
+		}
+	}
+
+	for (row = 0; row < font->height; row++)
+	{
+		int screenRow = y + row;
+		if (screenRow < 0 || screenRow >= DISPLAY_HEIGHT) continue;
+
+		for (w = 0; w < ROW_WORDS; w++)
+		{
+			uint32_t mask = rows[row][w];
+			if (!mask) continue;
+			pixels += __builtin_popcount(mask);
+
+			for (b = 0; b < COLOUR_DEPTH; b++)
+			{
+				struct bitPlane* plane = &screen->plane[b];
+				plane->red[screenRow][w] = (plane->red[screenRow][w] & ~mask) | ((colour.red >> b) & 1 ? mask : 0);
+				plane->green[screenRow][w] = (plane->green[screenRow][w] & ~mask) | ((colour.green >> b) & 1 ? mask : 0);
+				plane->blue[screenRow][w] = (plane->blue[screenRow][w] & ~mask) | ((colour.blue >> b) & 1 ? mask : 0);
+			}
+		}
+	}
+
+#if TEXT_STATS
+	textStats.cycles += halCycles() - startCycles;
+	if (last >= first) textStats.glyphsDrawn += last - first + 1;
+#endif
+	return pixels;
+}
+
+void drawMarquee(struct frameBuffer* screen, const struct font* font, int y, const char* text, int tick, struct pixel colour)
+// Draws text scrolled one column left per tick: it enters on the right, leaves on the left, and
+// starts again. Only the characters on the display are drawn, however long the text is.
+{
+	int travel = DISPLAY_WIDTH + textWidth(font, strlen(text)); // Columns from fully off the right to fully off the left
+	drawText(screen, font, DISPLAY_WIDTH - tick % travel, y, text, colour);
+}
+
+int formatNumber(char* text, uint32_t value)
+// Writes value in decimal with a terminating 0 into text, which must hold 11 characters.
+// Returns the number of digits.
+{
+	char digits[10];
+	int length = 0;
+	int i;
+
+	do
+	{
+		digits[length++] = '0' + value % 10;
+		value /= 10;
+	}
+	while (value);
+
+	for (i = 0; i < length; i++) text[i] = digits[length - 1 - i];
+	text[length] = 0;
+	return length;
+}
+
+int drawScore(struct frameBuffer* screen, const struct gameInfo* game)
+// Draws player 1's score in red just left of the centre line and player 2's in blue just right of it.
+// Returns the number of pixels drawn.
+{
+	char text[11];
+	int length = formatNumber(text, game->score1);
+	int pixels = drawText(screen, &font3x5, DISPLAY_WIDTH / 2 - 1 - textWidth(&font3x5, length), SCOREROW, text, red);
+
+	formatNumber(text, game->score2);
+	return pixels + drawText(screen, &font3x5, DISPLAY_WIDTH / 2 + 1, SCOREROW, text, blue);
+}
+
+rowMask renderFrame(struct frameBuffer* screen, struct renderState* shown, const struct gameInfo* game)
+// Brings a frame buffer up to date with the game state, touching only the rows whose contents change.
+// shown describes what the buffer held before and is updated to match. Returns the mask of redrawn rows.
+{
+	rowMask ballRow = (rowMask)1 << game->ballYCoordinate;
+	rowMask paddle1Rows = rowSpanMask(game->paddle1Position, PADDLELENGTH);
+	rowMask paddle2Rows = rowSpanMask(game->paddle2Position, PADDLELENGTH);
+	rowMask scoreRows = SCORE_OVERLAY ? rowSpanMask(SCOREROW, font3x5.height) : 0;
+	rowMask dirty;
+	uint32_t scorePixels = 0;
+
+	if (!shown->drawn)
+	{
+		dirty = rowSpanMask(0, DISPLAY_HEIGHT); // Nothing known about the buffer yet, redraw everything
+	}
+	else
+	{
+		// Rows an object has left or moved into
+		dirty = 0;
+		if (shown->ballXCoordinate != game->ballXCoordinate || shown->ballYCoordinate != game->ballYCoordinate)
+		{
+			dirty |= ((rowMask)1 << shown->ballYCoordinate) | ballRow;
+		}
+		dirty |= rowSpanMask(shown->paddle1Position, PADDLELENGTH) ^ paddle1Rows;
+		dirty |= rowSpanMask(shown->paddle2Position, PADDLELENGTH) ^ paddle2Rows;
+		if (shown->score1 != game->score1 || shown->score2 != game->score2) dirty |= scoreRows;
+	}
+	if (dirty & scoreRows) dirty |= scoreRows; // The score is redrawn whole, which costs little more than the rows it needs
+
+	// Blank the dirty rows, then redraw whatever belongs in them: the score under the ball, and the
+	// ball under the paddles
+	clearRows(screen, dirty);
+#if SCORE_OVERLAY
+	if (dirty & scoreRows)
+	{
+		PROFILE_START(text);
+		scorePixels = drawScore(screen, game);
+		PROFILE_END(PROFILE_TEXT, text);
+	}
+#endif
+	drawColumnRows(screen, game->ballXCoordinate, ballRow & dirty, white);
+	drawColumnRows(screen, 0, paddle1Rows & dirty, red);
+	drawColumnRows(screen, DISPLAY_WIDTH - 1, paddle2Rows & dirty, blue);
+
+	shown->drawn = 1;
+	shown->ballXCoordinate = game->ballXCoordinate;
+	shown->ballYCoordinate = game->ballYCoordinate;
+	shown->paddle1Position = game->paddle1Position;
+	shown->paddle2Position = game->paddle2Position;
+	shown->score1 = game->score1;
+	shown->score2 = game->score2;
+
+	renderStats.dirtyRows = dirty;
+	renderStats.rowsRedrawn = ROWMASK_POPCOUNT(dirty);
+	renderStats.pixelsTouched = renderStats.rowsRedrawn * DISPLAY_WIDTH + scorePixels
+		+ ROWMASK_POPCOUNT(ballRow & dirty) + ROWMASK_POPCOUNT(paddle1Rows & dirty) + ROWMASK_POPCOUNT(paddle2Rows & dirty);
+	renderStats.frames++;
+	renderStats.totalRowsRedrawn += renderStats.rowsRedrawn;
+	renderStats.totalPixelsTouched += renderStats.pixelsTouched;
+
+	return dirty;
+}
+
+// Generated by tools/sprite_convert.py from art/pompompurin0.ppm, art/pompompurin1.ppm, art/pompompurin2.ppm
+const struct paletteEntry pompompurinPalette[] =
+{
+	{0,0,0}, // Transparent
+	{255,0,0},
+	{255,255,0},
+};
+
+const uint16_t pompompurinFrames[] = {0,203,403};
+
+const uint8_t pompompurinData[] = // 603 bytes
+{
+	0xF0,0xF0,0xF0,0x01,0xE0,0xF0,0x01,0xE0,0xC0,0x51,0xC0,0xA0,0xA1,0x90,0x90,0xC1,
+	0x80,0x90,0xE1,0x60,0x80,0xC1,0x12,0x11,0x50,0x70,0x01,0x32,0x61,0x42,0x11,0x40,
+	0x60,0x01,0xF2,0x12,0x11,0x30,0x60,0x01,0xF2,0x22,0x01,0x30,0x50,0x01,0x22,0x01,
+	0x02,0x01,0x52,0x01,0x62,0x11,0x20,0x40,0x01,0x22,0x11,0xA2,0x01,0x52,0x01,0x10,
+	0x30,0x01,0x32,0x01,0x32,0x31,0x32,0x11,0x42,0x01,0x10,0x30,0x01,0x22,0x01,0x52,
+	0x11,0x52,0x01,0x42,0x01,0x10,0x20,0x01,0x32,0x01,0x52,0x01,0x62,0x01,0x52,0x01,
+	0x00,0x20,0x01,0x32,0x01,0x22,0x01,0x12,0x11,0x12,0x01,0x22,0x01,0x52,0x01,0x00,
+	0x10,0x11,0x32,0x01,0x12,0x11,0x02,0x51,0x12,0x11,0x52,0x01,0x00,0x10,0x01,0x42,
+	0x11,0x12,0x21,0x12,0x11,0x22,0x01,0x62,0x01,0x00,0x10,0x01,0x52,0x11,0xA2,0x11,
+	0x52,0x01,0x00,0x10,0x01,0x62,0x21,0x62,0x11,0x00,0x01,0x42,0x01,0x10,0x20,0x01,
+	0x42,0x01,0x10,0x11,0x42,0x11,0x10,0x01,0x32,0x11,0x10,0x20,0x11,0x12,0x21,0x20,
+	0x51,0x30,0x11,0x02,0x21,0x20,0x30,0x31,0xF0,0x11,0x50,0xF0,0xF0,0xF0,0xF0,0xF0,
+	0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0x01,0xE0,
+	0xF0,0x01,0xE0,0xC0,0x51,0xC0,0xA0,0xA1,0x90,0x90,0xC1,0x80,0x90,0xE1,0x60,0x80,
+	0xC1,0x12,0x11,0x50,0x70,0x01,0x32,0x61,0x42,0x11,0x40,0x60,0x01,0xF2,0x12,0x11,
+	0x30,0x60,0x01,0xF2,0x22,0x01,0x30,0x50,0x01,0x22,0x01,0x02,0x01,0x52,0x01,0x62,
+	0x11,0x20,0x40,0x01,0x22,0x11,0xA2,0x01,0x52,0x01,0x10,0x30,0x01,0x32,0x01,0x32,
+	0x31,0x32,0x11,0x42,0x01,0x10,0x30,0x01,0x22,0x01,0x52,0x11,0x52,0x01,0x42,0x01,
+	0x10,0x20,0x01,0x32,0x01,0x52,0x01,0x62,0x01,0x52,0x01,0x00,0x20,0x01,0x32,0x01,
+	0x22,0x01,0x12,0x11,0x12,0x01,0x22,0x01,0x52,0x01,0x00,0x10,0x11,0x32,0x01,0x12,
+	0x11,0x02,0x51,0x12,0x11,0x52,0x01,0x00,0x10,0x01,0x42,0x11,0x12,0x21,0x12,0x11,
+	0x22,0x01,0x62,0x01,0x00,0x10,0x01,0x52,0x11,0xA2,0x11,0x52,0x01,0x00,0x10,0x01,
+	0x62,0x21,0x62,0x11,0x00,0x01,0x42,0x01,0x10,0x20,0x01,0x42,0x01,0x10,0x11,0x42,
+	0x11,0x10,0x01,0x32,0x11,0x10,0x20,0x61,0x20,0x51,0x30,0x11,0x02,0x21,0x20,0xF0,
+	0x70,0x11,0x50,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,
+	0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0x01,0xE0,0xF0,0x01,0xE0,0xC0,0x51,0xC0,0xA0,0xA1,
+	0x90,0x90,0xC1,0x80,0x90,0xE1,0x60,0x80,0xC1,0x12,0x11,0x50,0x70,0x01,0x32,0x61,
+	0x42,0x11,0x40,0x60,0x01,0xF2,0x12,0x11,0x30,0x60,0x01,0xF2,0x22,0x01,0x30,0x50,
+	0x01,0x22,0x01,0x02,0x01,0x52,0x01,0x62,0x11,0x20,0x40,0x01,0x22,0x11,0xA2,0x01,
+	0x52,0x01,0x10,0x30,0x01,0x32,0x01,0x32,0x31,0x32,0x11,0x42,0x01,0x10,0x30,0x01,
+	0x22,0x01,0x52,0x11,0x52,0x01,0x42,0x01,0x10,0x20,0x01,0x32,0x01,0x52,0x01,0x62,
+	0x01,0x52,0x01,0x00,0x20,0x01,0x32,0x01,0x22,0x01,0x12,0x11,0x12,0x01,0x22,0x01,
+	0x52,0x01,0x00,0x10,0x11,0x32,0x01,0x12,0x11,0x02,0x51,0x12,0x11,0x52,0x01,0x00,
+	0x10,0x01,0x42,0x11,0x12,0x21,0x12,0x11,0x22,0x01,0x62,0x01,0x00,0x10,0x01,0x52,
+	0x11,0xA2,0x11,0x52,0x01,0x00,0x10,0x01,0x62,0x21,0x62,0x11,0x00,0x01,0x42,0x01,
+	0x10,0x20,0x01,0x42,0x01,0x10,0x11,0x42,0x11,0x10,0x01,0x32,0x11,0x10,0x20,0x11,
+	0x12,0x21,0x20,0x51,0x30,0x51,0x20,0x30,0x31,0xF0,0x70,0xF0,0xF0,0xF0,0xF0,0xF0,
+	0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,0xF0,
+};
+
+const struct sprite pompompurin = {32, 32, 3, 3, pompompurinPalette, pompompurinData, pompompurinFrames};
+
+void drawSprite(struct frameBuffer* screen, const struct sprite* sprite, int frame, int x, int y)
+// Decodes one frame of a sprite straight into the frame buffer with its top-left corner at (x, y).
+// Anything off the panel is clipped and palette entry 0 is left undrawn.
+// Each row is built up as word masks from its runs, then written with one mask per colour plane word.
+{
+	uint32_t colourBits[16]; // Bit 3b + c is channel c (red, green, blue) of colour plane b for each palette entry
+	const uint8_t* run = sprite->data + sprite->frames[frame];
+	int firstWord = (x + 32) / 32 - 1; // Row word holding the sprite's left edge, -1 if it starts left of the display
+	int shift = x - 32 * firstWord; // Position of the sprite's left edge within that word
+	int row;
+	int half;
+	int b;
+	int i;
+
+	if (x >= DISPLAY_WIDTH || x <= -sprite->width || y >= DISPLAY_HEIGHT || y <= -sprite->height) return; // Entirely off the panel
+
+	for (i = 1; i < sprite->colourCount; i++)
+	{
+		const struct paletteEntry* entry = &sprite->palette[i];
+		int red = entry->red >> (8 - COLOUR_DEPTH); // Keep the top COLOUR_DEPTH bits of each channel
+		int green = entry->green >> (8 - COLOUR_DEPTH);
+		int blue = entry->blue >> (8 - COLOUR_DEPTH);
+
+		colourBits[i] = 0;
+		for (b = 0; b < COLOUR_DEPTH; b++)
+		{
+			colourBits[i] |= (uint32_t)(((red >> b) & 1) | (((green >> b) & 1) << 1) | (((blue >> b) & 1) << 2)) << (3 * b);
+		}
+	}
+
+	for (row = 0; row < sprite->height; row++)
+	{
+		int screenRow = y + row;
+		int column = 0;
+		uint32_t opaque = 0; // Pixels this row draws
+		uint32_t channels[COLOUR_DEPTH][3] = {{0}}; // Lit pixels for each plane and channel
+
+		if (screenRow >= DISPLAY_HEIGHT) break; // The rest of the sprite is below the panel
+
+		while (column < sprite->width)
+		{
+			int length = (*run >> 4) + 1;
+			int index = *run & 15;
+			run++;
+
+			if (index && screenRow >= 0)
+			{
+				uint32_t mask = (((uint32_t)1 << length) - 1) << column;
+				uint32_t bits = colourBits[index];
+
+				opaque |= mask;
+				for (b = 0; b < COLOUR_DEPTH; b++, bits >>= 3)
+				{
+					if (bits & 1) channels[b][0] |= mask;
+					if (bits & 2) channels[b][1] |= mask;
+					if (bits & 4) channels[b][2] |= mask;
+				}
+			}
+			column += length;
+		}
+
+		if (screenRow < 0 || !opaque) continue; // Above the panel, or nothing to draw
+
+		// Move the row to the sprite's x position. It straddles at most two row words;
+		// the half falling in a word past either edge of the display is dropped.
+		for (half = 0; half < 2; half++)
+		{
+			int w = firstWord + half;
+			if (w < 0 || w >= ROW_WORDS) continue;
+
+			uint32_t mask = (uint32_t)(((uint64_t)opaque << shift) >> (32 * half));
+			if (!mask) continue;
+
+			for (b = 0; b < COLOUR_DEPTH; b++)
+			{
+				struct bitPlane* plane = &screen->plane[b];
+				plane->red[screenRow][w] = (plane->red[screenRow][w] & ~mask) | (uint32_t)(((uint64_t)channels[b][0] << shift) >> (32 * half));
+				plane->green[screenRow][w] = (plane->green[screenRow][w] & ~mask) | (uint32_t)(((uint64_t)channels[b][1] << shift) >> (32 * half));
+				plane->blue[screenRow][w] = (plane->blue[screenRow][w] & ~mask) | (uint32_t)(((uint64_t)channels[b][2] << shift) >> (32 * half));
+			}
+		}
+	}
+}
+
+void drawAttractFrame(struct frameBuffer* screen, int tick)
+// Draws one frame of the attract loop: pompompurin walking across the panel, rising a row with each
+// step, with a message scrolling along the bottom
+{
+	static const uint8_t walkCycle[] = {0, 1, 0, 2}; // Standing, left foot up, standing, right foot up
+	int frame = walkCycle[(tick / 4) % sizeof walkCycle];
+	int x = DISPLAY_WIDTH - tick % (DISPLAY_WIDTH + pompompurin.width); // Walk in from the right and all the way out on the left
+	int y = (DISPLAY_HEIGHT - pompompurin.height) / 2 - (frame != 0); // Centred vertically, clipped on panels shorter than it
+
+	clearScreen(screen);
+	PROFILE_START(sprite);
+	drawSprite(screen, &pompompurin, frame, x, y);
+	PROFILE_END(PROFILE_SPRITE, sprite);
+
+	PROFILE_START(text);
+	drawMarquee(screen, &font3x5, DISPLAY_HEIGHT - font3x5.height - 1, "MOVE A JOYSTICK TO PLAY", tick, white);
+	PROFILE_END(PROFILE_TEXT, text);
+}
+
+void initShiftOut(void)
+// Builds the BSRR patterns used by shiftOutWord from the pin assignments.
+// The lower half of BSRR sets pins and the upper half resets them.
+{
+	shiftBitPattern[0] = ((uint32_t)(INPUTSIGNAL | CLOCK) << 16); // Data low, clock low
+	shiftBitPattern[1] = INPUTSIGNAL | ((uint32_t)CLOCK << 16); // Data high, clock low
+	shiftClockHigh = CLOCK; // Clock high, data unchanged
+}
+
+void shiftOutWord(uint32_t bits)
+// Shifts 32 pixels of one colour plane into the display, least significant bit first.
+// Each bit costs two whole-port writes: data with clock low, then clock high.
+{
+#if SHIFT_UNROLL
+	// Present bit n and clock it in
+#define SHIFTBIT(n) \
+	halWritePins(shiftBitPattern[(bits >> (n)) & 1]); \
+	halWritePins(shiftClockHigh);
+
+	SHIFTBIT(0)  SHIFTBIT(1)  SHIFTBIT(2)  SHIFTBIT(3)  SHIFTBIT(4)  SHIFTBIT(5)  SHIFTBIT(6)  SHIFTBIT(7)
+	SHIFTBIT(8)  SHIFTBIT(9)  SHIFTBIT(10) SHIFTBIT(11) SHIFTBIT(12) SHIFTBIT(13) SHIFTBIT(14) SHIFTBIT(15)
+	SHIFTBIT(16) SHIFTBIT(17) SHIFTBIT(18) SHIFTBIT(19) SHIFTBIT(20) SHIFTBIT(21) SHIFTBIT(22) SHIFTBIT(23)
+	SHIFTBIT(24) SHIFTBIT(25) SHIFTBIT(26) SHIFTBIT(27) SHIFTBIT(28) SHIFTBIT(29) SHIFTBIT(30) SHIFTBIT(31)
+#undef SHIFTBIT
+#else
+	int i;
+	for (i = 0; i < 32; i++)
+	{
+		halWritePins(shiftBitPattern[bits & 1]); // Present the bit with the clock low
+		halWritePins(shiftClockHigh); // Pulse the clock to push this bit into memory
+		bits >>= 1; // Move on to the next pixel
+	}
+#endif
+}
+
+void shiftOutWordLibrary(uint32_t bits)
+// Original shift-out using one set/clear call per pin change, kept for measuring against shiftOutWord.
+{
+	int i;
+	for (i = 0; i < 32; i++) 
+	{
+		halClearPins(CLOCK); // Prepare to load the next piece of data
+		if(bits & 1) 
+		{
+			halSetPins(INPUTSIGNAL); // Set input to 1 if the pixel is lit
+		}
+		else halClearPins(INPUTSIGNAL); // Otherwise, set input to 0
+
+		halSetPins(CLOCK);  // Pulse the clock to push this bit into memory
+		bits >>= 1; // Move on to the next pixel
+	}
+}
+
+void pushToRow(int rowNum, const struct bitPlane* plane)
+// Pushes one bit plane of a given row address into the display's memory: the row it drives in the
+// lower half, then the one in the upper half, for each panel in turn. The leftmost panel goes first
+// as it is furthest along the chain. Processes each pixel's blue, green, and red components sequentially.
+{
+#if SHIFT_STATS
+	uint32_t startCycles = halCycles();
+#endif
+	int panel;
+	int half;
+	int w;
+
+	for (panel = 0; panel < PANEL_CHAIN; panel++)
+	{
+		for (half = 1; half >= 0; half--)
+		{
+			int row = rowNum + half * SCAN_ROWS;
+			const uint32_t* blue = &plane->blue[row][panel * PANEL_WORDS];
+			const uint32_t* green = &plane->green[row][panel * PANEL_WORDS];
+			const uint32_t* red = &plane->red[row][panel * PANEL_WORDS];
+
+#if SHIFT_LIBRARY_CALLS
+			for (w = 0; w < PANEL_WORDS; w++) shiftOutWordLibrary(blue[w]);
+			for (w = 0; w < PANEL_WORDS; w++) shiftOutWordLibrary(green[w]);
+			for (w = 0; w < PANEL_WORDS; w++) shiftOutWordLibrary(red[w]);
+#else
+			for (w = 0; w < PANEL_WORDS; w++) shiftOutWord(blue[w]);
+			for (w = 0; w < PANEL_WORDS; w++) shiftOutWord(green[w]);
+			for (w = 0; w < PANEL_WORDS; w++) shiftOutWord(red[w]);
+#endif
+		}
+	}
+
+#if SHIFT_STATS
+	shiftStats.cycles += halCycles() - startCycles;
+	shiftStats.rowsShifted++;
+	// Each path makes a fixed number of writes per bit, so the shift writes are worked out here
+	// rather than counted in the loop, which would slow down the shifting being timed
+	shiftStats.registerWrites += (SHIFT_LIBRARY_CALLS ? 3 : 2) * MAXROWLENGTH;
+#endif
+}
+
+void selectRow(int rowNum)
+// Converts a row number into its binary representation and sets the appropriate pins
+// Used to activate a specific row of the display for drawing
+{ 
+	int i;
+	int j = 1 << (ROW_ADDRESS_BITS - 1); // Start with the most significant bit (MSB) of the row address
+	for (i = 5 - ROW_ADDRESS_BITS; i < 5; i++) // Iterate over each bit in the binary representation
+	{
+		if(rowNum >= j)
+			{
+				halSetPins(ROWSELECT[i]); // Set the current bit to 1
+				rowNum -= j; // Subtract the value of the bit from the row number
+
+			}
+		else
+		{
+			halClearPins(ROWSELECT[i]); // Set the current bit to 0
+		}
+#if SHIFT_STATS
+		shiftStats.registerWrites++;
+#endif
+		j = j / 2; // Move to the next less significant bit
+	}
+}
+
+int filterJoyStick(int player1Or2, int* state)
+// Averages a player's latest samples and returns the direction they give (1 up, -1 down, 0 neither),
+// which is also stored in *state. The previous *state sets the thresholds.
+{
+	int i;
+	uint32_t value = 0;
+
+	for (i = player1Or2; i < JOYSTICK_OVERSAMPLE * 2; i += 2)  // Every other sample belongs to this player
+	{
+		value += joyStickSamples[i];
+	}
+	value /= JOYSTICK_OVERSAMPLE;
+
+	// Hysteresis: once a direction is reported, the reading has to fall back past the threshold
+	// by JOYSTICK_HYSTERESIS before it is released, so a stick resting near a threshold doesn't jitter
+	if (value > (*state == 1 ? 3000 - JOYSTICK_HYSTERESIS : 3000)) *state = 1; // Joystick moved up
+	else if (value < (*state == -1 ? 1000 + JOYSTICK_HYSTERESIS : 1000)) *state = -1; // Joystick moved down
+	else *state = 0; // No significant movement detected
+	return *state;
+}
+
+int readValueFromJoyStick(int player1Or2) 
+// Reads the joystick's position for a given player (0 for player 1, 1 for player 2).
+// Averages the latest samples DMA has collected, so it never waits on the ADC.
+// Returns:
+// 1 if the joystick is moved up
+// -1 if the joystick is moved down
+// 0 if no significant movement is detected
+{
+#if INPUT_STATS
+	uint32_t startCycles = halCycles();
+	int previous = joyStickState[player1Or2];
+#endif
+	int direction = filterJoyStick(player1Or2, &joyStickState[player1Or2]);
+
+#if INPUT_STATS
+	// The game moves the paddle on the tick that reads a new direction, so time the change to here
+	if (direction != previous && joyStickChangePending[player1Or2] && direction == joyStickSampledState[player1Or2])
+	{
+		uint32_t latency = halLatencyCycles() - joyStickChangeCycles[player1Or2];
+		inputStats.latencyCycles += latency;
+		if (latency > inputStats.maxLatencyCycles) inputStats.maxLatencyCycles = latency;
+		inputStats.latencies++;
+	}
+	if (direction != previous) joyStickChangePending[player1Or2] = 0;
+	inputStats.readCycles += halCycles() - startCycles;
+	inputStats.reads++;
+#endif
+	return direction;
+}
+
+#if INPUT_STATS
+void joyStickSampled(void)
+// Called as DMA finishes each pass over the sample buffer. Notes when a pass changes a player's
+// direction, for readValueFromJoyStick to time how long the game takes to act on it.
+// Filtering both players here costs about as much as two reads, once per pass.
+{
+	int p;
+
+	inputStats.ringPasses++;
+	for (p = 0; p < 2; p++)
 	{
-		if ((ballInfo->ballYCoordinate) != 0) // If ball is not at the top
+		int previous = joyStickSampledState[p];
+		if (filterJoyStick(p, &joyStickSampledState[p]) != previous)
 		{
-			ballInfo->ballYCoordinate -= 1; // Move ball up
-		}
-		else
-		{ 
-			ballInfo->ballYDirection =  0; // Change y-direction to moving down
-			ballInfo->ballYCoordinate += 1; // Move ball down
+			joyStickChangeCycles[p] = halLatencyCycles();
+			joyStickChangePending[p] = 1;
 		}
 	}
-	else // Ball is moving down
+}
+
+void measureBlockingReads(void)
+// Times the original way of reading the joysticks, a blocking conversion per read, so INPUT_STATS
+// can show what background sampling saves. Runs before the ADC starts converting continuously.
+{
+	int i;
+	for (i = 0; i < JOYSTICK_BLOCKING_READS; i++)
 	{
-		if ((ballInfo->ballYCoordinate) != 31) // If ball is not at the bottom
-		{
-			ballInfo->ballYCoordinate += 1; // Move ball down
-		}
-		else
-		{ 
-			ballInfo->ballYDirection =  1; // Change y-direction to moving up
-			ballInfo->ballYCoordinate -= 1; // Move ball up
-		}
-	} 
+		uint32_t startCycles = halCycles();
+		halReadJoyStickBlocking(i & 1);
+		inputStats.blockingCycles += halCycles() - startCycles;
+		inputStats.blockingReads++;
+	}
 }
+#endif
 
-void moveBallHorizontal(struct gameInfo* ballInfo)
-// Handles horizontal movement of the ball including interaction with paddles
+uint8_t nextInput(uint32_t* replayTicks, const struct gameInfo* game)
+// Returns this tick's input: the next byte of the replay while replayTicks lasts, then the joysticks
+// and the CPU players
 {
-	if(ballInfo->ballXDirection) // If ball is moving right
+	uint8_t input;
+
+	if (*replayTicks && halReadReplay(&input, 1))
 	{
-		if((ballInfo->ballXCoordinate) < 30) // If ball is not next to the right-hand paddle
-		{
-			ballInfo->ballXCoordinate += 1; // Move ball right 
-		}
-		else if ((ballInfo->ballXCoordinate) == 30)  // If ball is vertically aligned with the right-hand paddle
-		{	
-			if (paddleExists(ballInfo->ballYCoordinate, ballInfo->paddle2Position, PADDLELENGTH)) // If the right-hand paddle hits the ball
-				ballInfo->ballXDirection = 0; // Change x-direction to moving left
-				ballInfo->ballXCoordinate -= 1; // Move ball left 
-			} 
-			else
-			{	
-				ballInfo->ballXCoordinate += 1; // Ball continues moving right
-			}
-		else // Reset ball position after missing the paddle
-		{
-			ballInfo->ballXDirection = 0; // Change x-direction to moving left
-			ballInfo->ballXCoordinate = 15; // Re-centre ball	
-		}
+		(*replayTicks)--;
+		return input;
 	}
-	
-	else // If ball is moving left
+	*replayTicks = 0;
+	input = packInput(CPU_PLAYERS & 1 ? 0 : readValueFromJoyStick(0), CPU_PLAYERS & 2 ? 0 : readValueFromJoyStick(1));
+	return CPU_PLAYERS ? cpuInput(game, input, CPU_PLAYERS) : input;
+}
+
+void clearScreen(struct frameBuffer* screen)
+// Resets the screen buffer by setting all pixels to blank (no colour).
+// Every 32 pixels of a row of a colour plane are cleared with a single word store.
+{
+	int i;
+	int w;
+	int b;
+	for (b = 0; b < COLOUR_DEPTH; b++)
 	{
-		if((ballInfo->ballXCoordinate) > 1) // If ball is not next to the left-hand paddle
+		for (i = 0; i < DISPLAY_HEIGHT; i++)
 		{
-			ballInfo->ballXCoordinate -= 1; // Move ball left
-		}
-
-		else if (ballInfo->ballXCoordinate == 1) // If ball is vertically aligned with the left-hand paddle
-		{	
-			if (paddleExists(ballInfo->ballYCoordinate ,ballInfo->paddle1Position, PADDLELENGTH)) // If the left-hand paddle hits the ball
-			{ // bounce the ball off the paddle
-				ballInfo->ballXDirection =  1; // Change x-direction to moving right
-				ballInfo->ballXCoordinate += 1; // Move ball right
-			} 
-			else
-			{	
-				ballInfo->ballXCoordinate -= 1; // Ball continues moving left
+			for (w = 0; w < ROW_WORDS; w++)
+			{
+				screen->plane[b].red[i][w] = 0;
+				screen->plane[b].green[i][w] = 0;
+				screen->plane[b].blue[i][w] = 0;
 			}
 		}
-		else // Reset ball position after missing the paddle
-		{
-			ballInfo->ballXDirection = 1; // Change x-direction to moving right
-			ballInfo->ballXCoordinate = 15; // Re-centre ball
-		}
 	}
 }
 
-void movePaddle(int player1or2,struct gameInfo* paddleInfo) // false if p1, true if p2
-// Moves the paddle of the specified player up or down based on joystick input
+void initScanner(void)
+// Starts the row timer interrupting once per row and bit plane so the panel refreshes in the background.
+// Each row's time is split between its planes so plane b is lit for 2^b units (Binary Code Modulation).
+// A plane stays lit while the next one is shifted in, from its latch to the next, so it is lit for
+// its whole slot and the slots themselves carry the weights.
 {
-	int* paddleStartLocation;
+	int b;
+	uint32_t rowTicks = halTimerFrequency() / (SCAN_REFRESH_HZ * SCAN_ROWS); // Timer ticks per row address
+	uint32_t shiftTicks;
+	uint32_t unitTicks;
 
-	// Determine which paddle's position (use as paddle start location) to modify based on the player
-	if (!player1or2) paddleStartLocation = &(paddleInfo->paddle1Position); 
-	else paddleStartLocation = &(paddleInfo->paddle2Position); 
+	// Time one slot's shift-out so the lit time of each plane can be made proportional to its weight
+	uint32_t startCycles = halCycles();
+	pushToRow(0, &frontBuffer->plane[0]);
+	shiftTicks = (halCycles() - startCycles) / (halCyclesPerSecond() / halTimerFrequency());
+	shiftTicks += shiftTicks / 4; // Margin for interrupt entry and row selection
 
-	// Check if the joystick indicates upward movement and the paddle isn't at the top edge
-	if (readValueFromJoyStick(player1or2) == 1 && (*paddleStartLocation != 0)) 
+	// Share the row time between the planes by weight. Plane 0's slot has to fit the next shift-out,
+	// so if the target rate needs a shorter unit, keep the weights and refresh more slowly instead.
+	unitTicks = rowTicks / COLOUR_MAX;
+	if (unitTicks < shiftTicks) unitTicks = shiftTicks;
+
+	for (b = 0; b < COLOUR_DEPTH; b++)
 	{
-		*paddleStartLocation -= 1; // Move paddle up
+		scanPlanePeriod[b] = unitTicks << b;
 	}
-	    // Check if the joystick indicates downward movement and the paddle isn't at the bottom edge
-	else if (readValueFromJoyStick(player1or2) == -1 && (*paddleStartLocation != 31 - PADDLELENGTH)) // // if joystick moved down and paddle start location is not at the bottom, move paddle down
+
+	refreshWindowStart = halCycles();
+	halStartRowTimer(scanPlanePeriod[0]);
+}
+
+void scanNextRow(void)
+// Displays the next bit plane of the current row address from the front buffer, then moves on
+// to the next plane, row and refresh. Buffers are swapped at the end of each refresh if asked to.
+{
+	PROFILE_START(scan);
+	int row = scanRow;
+	int b = scanPlane;
+
+	halSetRowTimerPeriod(scanPlanePeriod[b]); // This plane stays lit until the next interrupt
+
+	halClearPins(LATCH); // Disable memory output temporarily
+
+	// Push data for the current row and its mirrored row on every panel
+	pushToRow(row, &frontBuffer->plane[b]);
+
+	selectRow(row); // Select the row to display
+
+	halSetPins(LATCH); // Enable memory output to show changes
+#if SHIFT_STATS
+	shiftStats.registerWrites += 2; // The two latch writes
+#endif
+	PROFILE_END(PROFILE_SCAN, scan);
+
+	if (++b < COLOUR_DEPTH)
 	{
-		*paddleStartLocation += 1; // Move paddle down
+		scanPlane = b;
+		return;
 	}
-}
+	scanPlane = 0;
 
-int paddleExists(int ballYposition, int paddlePosition, int length)
-// Checks if the ball's vertical position overlaps with the paddle's vertical range
+	if (++row < SCAN_ROWS)
 	{
-		if (ballYposition >= paddlePosition && ballYposition <= (paddlePosition + length)) return 1; // if ball is within the vertical range of the paddle
-		else return 0;
+		scanRow = row;
+		return;
 	}
 
-void drawPaddlesToScreen(struct pixel screen[32][32], int paddle1Position, int paddle2Position)
-// Draws both paddles onto the screen: player 1's red paddle on the left and player 2's blue paddle on the right
-{	
-	int i;
+	// Whole panel shown: this is the vsync point
+	scanRow = 0;
+	if (swapRequested)
+	{
+		struct frameBuffer* shown = frontBuffer;
+		frontBuffer = backBuffer;
+		backBuffer = shown;
+		swapRequested = 0;
+	}
 
-	// Draw player 1's paddle red
-	for (i = paddle1Position; i < paddle1Position + PADDLELENGTH; i++)
+	refreshCount++;
+	if (halCycles() - refreshWindowStart >= halCyclesPerSecond()) // A second has passed
 	{
-		screen[i][0] = red;
-	} 
+		refreshRateHz = refreshCount;
+		refreshCount = 0;
+		refreshWindowStart += halCyclesPerSecond();
+	}
+}
+
+void swapBuffers(void)
+// Hands the finished back buffer to the scan interrupt and waits for the next vsync.
+// On return backBuffer points at the old front buffer, ready to be drawn into.
+{
+	swapRequested = 1;
+	while (swapRequested) schedulerIdle(swapDone); // The interrupt swaps the buffers between refreshes
+}
+
+int swapDone(void)
+// Wake condition for swapBuffers
+{
+	return !swapRequested;
+}
+
+void initScheduler(void)
+// Starts the game tick interrupt
+{
+	schedulerMinLateness = UINT32_MAX;
+	halStartTickTimer(GAME_TICK_HZ);
+}
+
+void gameTickDue(void)
+// Called from the tick interrupt GAME_TICK_HZ times a second
+{
+	tickDueCycles = halCycles();
+	ticksDue++;
+}
+
+int tickIsDue(void)
+// Wake condition for waitForTicks
+{
+	return ticksDue != 0;
+}
+
+void schedulerIdle(int (*ready)(void))
+// Sleeps until the next interrupt, or not at all if ready is given and already holds, adding the
+// time asleep to the idle figure
+{
+	schedulerIdleCycles += halIdle(ready);
+}
+
+int takeTicks(void)
+// Takes the game ticks that are due without waiting, updates the scheduler figures and returns how
+// many updates to run to catch up, or 0 if no tick is due.
+// After a slow frame up to GAME_MAX_CATCHUP ticks are run back to back, so the game keeps its pace
+// as long as frames are fast on average; beyond that ticks are dropped and the game slows down.
+{
+	uint32_t due;
+	uint32_t lateness;
+	uint32_t tickCycles = halCyclesPerSecond() / GAME_TICK_HZ;
+
+	if (!ticksDue) return 0;
 
-	// Draw player 2's paddle blue
-	for (i = paddle2Position; i < paddle2Position + PADDLELENGTH; i++)
+	// Take the waiting ticks with the tick interrupt held off, so one falling due meanwhile isn't
+	// lost and the lateness is measured from the tick that was taken
+	halDisableInterrupts();
+	due = ticksDue;
+	ticksDue = 0;
+	lateness = halCycles() - tickDueCycles;
+	halEnableInterrupts();
+
+	lateness += (due - 1) * tickCycles; // How long the oldest waiting tick has been due
+	if (lateness < schedulerMinLateness) schedulerMinLateness = lateness;
+	if (lateness > schedulerMaxLateness) schedulerMaxLateness = lateness;
+
+	schedulerStats.missedDeadlines += due - 1;
+	schedulerWindowTicks += due;
+	if (due > GAME_MAX_CATCHUP)
 	{
-		screen[i][31] = blue;
-	} 
+		schedulerStats.droppedTicks += due - GAME_MAX_CATCHUP;
+		due = GAME_MAX_CATCHUP;
+	}
+	schedulerStats.ticksRun += due;
+
+	if (schedulerWindowTicks >= GAME_TICK_HZ) // A second has passed
+	{
+		schedulerStats.idlePercent = (uint64_t)schedulerIdleCycles * 100 / halCyclesPerSecond();
+		schedulerStats.jitterCycles = schedulerMaxLateness - schedulerMinLateness;
+		schedulerStats.maxLatenessCycles = schedulerMaxLateness;
+		schedulerWindowTicks -= GAME_TICK_HZ;
+		schedulerIdleCycles = 0;
+		schedulerMinLateness = UINT32_MAX;
+		schedulerMaxLateness = 0;
+	}
+	return due;
 }
 
-void drawBallToScreen(struct pixel screen[32][32], int ballXPosition, int ballYPosition)
-// Draws the ball at its current position on the screen in white
+int waitForTicks(void)
+// Sleeps until at least one game tick is due, then takes the ticks as takeTicks does
 {
-	screen[ballYPosition][ballXPosition] = white; 
-} 
+	while (!ticksDue) schedulerIdle(tickIsDue);
+	return takeTicks();
+}
 
-struct pixel pompompurin[32][32] =
-{//  0 1 2 3 4 5 6 7 8 9 a B C D {0,0,0} F 0 1 2 3 4 5 6 7 8 9 A B C D {0,0,0} F
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0}},// 0
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{1,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0}},// 1
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{1,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0}},// 2
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0}},// 3
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0}},// 4
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0}},// 5
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0}},// 6
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0}},// 7
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0}},// 8
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0}},// 9
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0}},// A
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,1,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{0,0,0},{0,0,0},{0,0,0}},// B
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{0,0,0},{0,0,0}},// C
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{0,0,0},{0,0,0}},// D
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{0,0,0},{0,0,0}},// {0,0,0}
-	{{0,0,0},{0,0,0},{0,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{0,0,0}},// F
-	{{0,0,0},{0,0,0},{0,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{1,1,0},{1,1,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{0,0,0}},// 0
-	{{0,0,0},{0,0,0},{1,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{1,1,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{0,0,0}},// 1
-	{{0,0,0},{0,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{1,0,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{0,0,0}},// 2
-	{{0,0,0},{0,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{0,0,0}},// 3
-	{{0,0,0},{0,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{0,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{0,0,0},{0,0,0}},// 4
-	{{0,0,0},{0,0,0},{0,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{0,0,0},{0,0,0},{1,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{0,0,0},{0,0,0},{1,0,0},{1,1,0},{1,1,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{0,0,0},{0,0,0}},// 5
-	{{0,0,0},{0,0,0},{0,0,0},{1,0,0},{1,0,0},{1,1,0},{1,1,0},{1,0,0},{1,0,0},{1,0,0},{0,0,0},{0,0,0},{0,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{1,0,0},{1,0,0},{1,1,0},{1,0,0},{1,0,0},{1,0,0},{0,0,0},{0,0,0},{0,0,0}},// 6
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{1,0,0},{1,0,0},{1,0,0},{1,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{1,0,0},{1,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0}},// 7
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0}},// 8
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0}},// 9
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0}},// a
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0}},// B
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0}},// C
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0}},// D
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0}},// {0,0,0}
-	{{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0},{0,0,0}}// F
-	};
-
-void pushToRow(struct pixel pixelArray[32])
-// Pushes the colour data of a given row into the display's memory.
-// Processes each pixel's blue, green, and red components sequentially.
+#if STREAM_MODE
+void streamRestoreRows(struct frameBuffer* back, rowMask rows)
+// Copies the given rows of every plane from the front buffer, so back matches the frame on show
 {
-	int i;
+	const struct frameBuffer* front = frontBuffer;
+	int b;
+	int w;
 
-	 // Process the blue channel for all pixels in the row
-	for (i = 0; i < 32; i++) 
+	for (b = 0; b < COLOUR_DEPTH; b++)
 	{
-		gpio_clear(GPIOC, CLOCK); // Prepare to load the next piece of data
-		if(pixelArray[i].blue) 
+		rowMask remaining = rows;
+		while (remaining)
 		{
-			gpio_set(GPIOC, INPUTSIGNAL); // Set input to 1 if the pixel is blue
+			int i = ROWMASK_CTZ(remaining);
+			remaining &= remaining - 1;
+
+			for (w = 0; w < ROW_WORDS; w++)
+			{
+				back->plane[b].red[i][w] = front->plane[b].red[i][w];
+				back->plane[b].green[i][w] = front->plane[b].green[i][w];
+				back->plane[b].blue[i][w] = front->plane[b].blue[i][w];
+			}
 		}
-		else gpio_clear(GPIOC,INPUTSIGNAL); // Otherwise, set input to 0
+	}
+}
 
-		gpio_set(GPIOC,CLOCK);  // Pulse the clock to push this bit into memory
+rowMask streamWordRows(uint32_t word, uint32_t count)
+// Returns the rows holding count frame buffer words starting at word
+{
+	rowMask rows = 0;
+	while (count--)
+	{
+		rows |= (rowMask)1 << (word / ROW_WORDS % DISPLAY_HEIGHT);
+		word++;
 	}
+	return rows;
+}
 
-	// Repeat the same process for the green channel
-	for (i = 0; i < 32; i++) 
+static inline void streamSum(struct streamParser* parser, uint8_t byte)
+// Adds a byte to the Fletcher-16 sums
+{
+	parser->sum1 += byte;
+	if (parser->sum1 >= 255) parser->sum1 -= 255;
+	parser->sum2 += parser->sum1;
+	if (parser->sum2 >= 255) parser->sum2 -= 255;
+}
+
+void streamTorn(struct streamParser* parser)
+// Gives up on the packet being received. The back buffer may be half written, so deltas have to
+// wait for the next full frame.
+{
+	streamStats.tornFrames++;
+	parser->needFull = 1;
+	parser->state = STREAM_WAIT_SYNC1;
+}
+
+void streamStartPayload(struct streamParser* parser, struct frameBuffer* back)
+// Checks a packet's header and gets ready to write its payload into back
+{
+	int type = parser->header[0];
+	int sequence = parser->header[1];
+
+	parser->length = getU16(parser->header + 2);
+	parser->count = 0;
+	parser->itemCount = 0;
+	parser->itemLeft = 0;
+	parser->changedRows = 0;
+
+	if (parser->lastSequence >= 0 && (uint8_t)(sequence - parser->lastSequence - 1))
 	{
-		gpio_clear(GPIOC, CLOCK);
-		if(pixelArray[i].green) 
-		{
-			gpio_set(GPIOC, INPUTSIGNAL);
-		}
-		else gpio_clear(GPIOC,INPUTSIGNAL);
+		streamStats.droppedFrames += (uint8_t)(sequence - parser->lastSequence - 1);
+		parser->needFull = 1; // A delta would apply to a frame that never arrived
+	}
+	parser->lastSequence = sequence;
 
-		gpio_set(GPIOC,CLOCK);
+	if (type > STREAM_DELTA || (type == STREAM_FULL && parser->length != STREAM_FRAME_BYTES))
+	{
+		streamTorn(parser);
+		return;
 	}
 
-	// Repeat the same process for the red channel
-	for (i = 0; i < 32; i++)
+	parser->writing = type == STREAM_FULL || !parser->needFull;
+	if (!parser->writing) streamStats.droppedFrames++; // No frame to apply the changes to
+	else if (type == STREAM_DELTA)
+	{
+		// back holds the frame before the one on show; catch it up before applying the changes
+		streamRestoreRows(back, parser->shownRows);
+		parser->shownRows = 0;
+	}
+	parser->state = parser->length ? STREAM_PAYLOAD : STREAM_CHECKSUM;
+}
+
+int streamPayloadByte(struct streamParser* parser, uint8_t* out, uint8_t byte)
+// Writes one payload byte into the frame buffer at out. Returns 0 if the payload is malformed.
+{
+	if (!parser->writing) return 1;
+
+	if (parser->header[0] == STREAM_FULL)
+	{
+		out[parser->count] = byte; // The payload is the frame buffer, byte for byte
+	}
+	else if (parser->itemCount < 3) // Part of a delta item's header
 	{
-		gpio_clear(GPIOC, CLOCK);
-		if(pixelArray[i].red) 
+		parser->item[parser->itemCount++] = byte;
+		if (parser->itemCount == 3)
 		{
-			gpio_set(GPIOC, INPUTSIGNAL);
+			uint32_t word = getU16(parser->item);
+			uint32_t words = parser->item[2];
+
+			if (word + words > STREAM_FRAME_BYTES / 4) return 0;
+			parser->itemOffset = 4 * word;
+			parser->itemLeft = 4 * words;
+			parser->changedRows |= streamWordRows(word, words);
+			if (!words) parser->itemCount = 0;
 		}
-		else gpio_clear(GPIOC,INPUTSIGNAL);
+	}
+	else // One of the item's words
+	{
+		out[parser->itemOffset++] = byte;
+		if (!--parser->itemLeft) parser->itemCount = 0; // Next item
+	}
+	return 1;
+}
 
-		gpio_set(GPIOC,CLOCK);
+int streamEndPacket(struct streamParser* parser)
+// Checks the checksum of the packet just received. Returns 1 if it completed a frame to show.
+{
+	parser->state = STREAM_WAIT_SYNC1;
+	if (!parser->writing) return 0;
+
+	if (parser->checksum[0] != parser->sum1 || parser->checksum[1] != parser->sum2 || parser->itemCount)
+	{
+		streamTorn(parser);
+		return 0;
+	}
+
+	if (parser->header[0] == STREAM_FULL)
+	{
+		parser->needFull = 0;
+		parser->shownRows = rowSpanMask(0, DISPLAY_HEIGHT); // The other buffer differs everywhere
+		streamStats.fullFrames++;
+	}
+	else
+	{
+		parser->shownRows = parser->changedRows;
+		streamStats.deltaFrames++;
 	}
+	return 1;
 }
 
-void selectRow(int rowNum)
-// Converts a row number into its binary representation and sets the appropriate pins
-// Used to activate a specific row of the display for drawing
-{ 
-	int i;
-	int j = 8; // Start with the most significant bit (MSB) of a 4-bit binary number
-	for (i = 0; i < 4; i++) // Iterate over each bit in the 4-bit binary representation
+int streamPoll(struct frameBuffer* back)
+// Parses whatever has arrived in the ring since the last call, writing frame data straight into back
+// with no staging copy. Returns 1 as soon as a whole frame has arrived and passed its checks, leaving
+// any bytes after it for the next call; back then holds the new frame, ready to swap in.
+{
+	struct streamParser* parser = &streamParser;
+	uint8_t* out = (uint8_t*)back->plane; // Payloads use struct frameBuffer's layout, little-endian as on the STM32
+	uint32_t received = halStreamReceived();
+
+	if (received - parser->consumed > STREAM_RING_SIZE) // DMA has lapped the parser and unread bytes are gone
 	{
-		if(rowNum >= j)
+		streamStats.overruns++;
+		if (parser->state >= STREAM_PAYLOAD) streamTorn(parser);
+		parser->state = STREAM_WAIT_SYNC1;
+		parser->needFull = 1; // Whatever frames were lost, the next delta can't be trusted
+		parser->consumed = received;
+	}
+
+	while (parser->consumed != received)
+	{
+		uint8_t byte = streamRing[parser->consumed++ % STREAM_RING_SIZE];
+		streamStats.bytes++;
+
+		switch (parser->state)
+		{
+		case STREAM_WAIT_SYNC1:
+			if (byte == STREAM_SYNC1) parser->state = STREAM_WAIT_SYNC2;
+			break;
+
+		case STREAM_WAIT_SYNC2:
+			if (byte == STREAM_SYNC2)
 			{
-				gpio_set(GPIOC,ROWSELECT[i]); // Set the current bit to 1
-				rowNum -= j; // Subtract the value of the bit from the row number
+				parser->state = STREAM_HEADER;
+				parser->count = 0;
+				parser->sum1 = 0;
+				parser->sum2 = 0;
+			}
+			else if (byte != STREAM_SYNC1) parser->state = STREAM_WAIT_SYNC1;
+			break;
 
+		case STREAM_HEADER:
+			streamSum(parser, byte);
+			parser->header[parser->count++] = byte;
+			if (parser->count == STREAM_HEADER_SIZE) streamStartPayload(parser, back);
+			break;
+
+		case STREAM_PAYLOAD:
+			streamSum(parser, byte);
+			if (!streamPayloadByte(parser, out, byte)) streamTorn(parser);
+			else if (++parser->count == parser->length)
+			{
+				parser->state = STREAM_CHECKSUM;
+				parser->count = 0;
 			}
-		else
-		{
-			gpio_clear(GPIOC,ROWSELECT[i]); // Set the current bit to 0
+			break;
+
+		case STREAM_CHECKSUM:
+			parser->checksum[parser->count++] = byte;
+			if (parser->count == 2 && streamEndPacket(parser)) return 1;
+			break;
 		}
-		j = j / 2; // Move to the next less significant bit
 	}
+	return 0;
 }
 
-int readValueFromJoyStick(int player1Or2) 
-// Reads the joystick's position for a given player (0 for player 1, 1 for player 2).
-// Returns:
-// 1 if the joystick is moved up
-// -1 if the joystick is moved down
-// 0 if no significant movement is detected
+void streamFrames(void)
+// Shows frames from the stream as they arrive instead of running the game. Never returns.
+// Between frames the CPU sleeps; the scan and tick interrupts wake it often enough to keep up
+// with the ring, since DMA only interrupts twice per pass. Game ticks are still taken, so the
+// scheduler figures stay current and profile telemetry goes out every PROFILE_DUMP_TICKS ticks.
 {
-	int currentChannel;
-	if (!player1Or2) currentChannel = 1; // If player 1, select channel 1
-	else currentChannel = 6; // For player 2, select channel 6
+	streamParser.lastSequence = -1;
+	streamParser.needFull = 1; // Deltas mean nothing until a full frame has arrived
+	streamWindowStart = halCycles();
+	halStartStream(streamRing, STREAM_RING_SIZE);
+
+	while (1)
+	{
+		if (streamPoll(backBuffer))
+		{
+			PROFILE_START(vsync);
+			 swapBuffers(); // Shown from the next refresh; backBuffer is then the frame before it
+			PROFILE_END(PROFILE_VSYNC, vsync);
+			streamStats.framesShown++;
+			streamWindowFrames++;
+		}
+		else schedulerIdle(NULL); // Any interrupt may have brought more bytes
 
-	uint8_t channelArray[] = {currentChannel};  // Defines the channel that we want to look at
-	adc_set_regular_sequence(ADC1, 1, channelArray);  // Set up the channel
-	adc_start_conversion_regular(ADC1);  // Start converting the analogue signal
+		if (takeTicks())
+		{
+#if PROFILE
+			profileTick();
+#endif
+		}
 
-	while (!(adc_eoc(ADC1)));  // Wait until the register is ready to read data
+		if (halCycles() - streamWindowStart >= halCyclesPerSecond()) // A second has passed
+		{
+			streamStats.framesPerSecond = streamWindowFrames;
+			streamWindowFrames = 0;
+			streamWindowStart += halCyclesPerSecond();
+		}
+	}
+}
+#endif
 
-	uint32_t value = adc_read_regular(ADC1);  // Read the value from the register and channel
+#if PROFILE
+void profileRecord(enum profileStage stage, uint32_t cycles)
+// Adds one cycle count to a stage's statistics
+{
+	volatile struct profileStats* stats = &profileStats[stage];
 
-	if (value > 3000) return 1; // Joystick moved up
-	if (value < 1000) return -1; // Joystick moved down
-	else return 0; // No signfiicant movement detected
+	stats->samples[stats->count % PROFILE_RING_SIZE] = cycles;
+	if (stats->count == 0 || cycles < stats->min) stats->min = cycles;
+	if (cycles > stats->max) stats->max = cycles;
+	stats->total += cycles;
+	stats->count++;
 }
 
-void clearScreen(struct pixel screen[32][32])
-// Resets the screen array by setting all pixels to blank (no colour).
+uint32_t profilePercentile(const volatile uint32_t* samples, int count, int percent)
+// Returns the given percentile of count samples, using a sorted copy
 {
+	uint32_t sorted[PROFILE_RING_SIZE];
 	int i;
 	int j;
-	for (i = 0; i < 32; i++)
+
+	for (i = 0; i < count; i++) // Insertion sort: the ring is small and this runs once per record
 	{
-		for (j = 0; j < 32; j++)
-		{
-			screen[i][j] = blank;
-		}
+		uint32_t value = samples[i];
+		for (j = i; j > 0 && sorted[j - 1] > value; j--) sorted[j] = sorted[j - 1];
+		sorted[j] = value;
 	}
+	return sorted[(count * percent + 99) / 100 - 1];
 }
 
-int main(void)
-// Main function to initialise and configure the system, as well as execute the game loop
+void profileDump(void)
+// Packs every stage's statistics and recent samples into a telemetry record, sends it and starts
+// a new measurement window. Skipped if the previous record is still being sent.
+//
+// Header: u16 magic, u8 version, u8 stage count, u16 samples per stage, u16 reserved,
+//         u32 cycles per second, u32 sequence number
+// Stage:  u32 count, u32 min, u32 max, u32 average, u32 p99, then u32 samples[samples per stage]
+//         of which the first min(count, samples per stage) are valid
 {
-	rcc_periph_clock_enable(RCC_GPIOC);
-
+	uint8_t* out = profileRecordBuffer;
+	int stage;
 	int i;
 
-	for (i = 0; i < 7; i++) 
+	if (halTelemetryBusy())
 	{
-		gpio_mode_setup(GPIOC, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, ALLPINS[i]); // GPIO Port Name, GPIO Mode, GPIO Push Up Pull Down Mode, GPIO Pin Number
-		gpio_set_output_options(GPIOC, GPIO_OTYPE_PP, GPIO_OSPEED_100MHZ, ALLPINS[i]);
+		profileDropped++;
+		return;
 	}
-	rcc_periph_clock_enable(RCC_ADC12); // Enable clock for ADC registers 1 and 2
 
-	adc_power_off(ADC1);  // turn off ADC register 1 whist we set it up
+	putU16(out, PROFILE_MAGIC);
+	out[2] = PROFILE_VERSION;
+	out[3] = PROFILE_STAGES;
+	putU16(out + 4, PROFILE_RING_SIZE);
+	putU16(out + 6, 0);
+	putU32(out + 8, halCyclesPerSecond());
+	putU32(out + 12, profileSequence++);
+	out += PROFILE_HEADER_SIZE;
 
-	adc_set_clk_prescale(ADC1, ADC_CCR_CKMODE_DIV1);  // Setup a scaling, none is fine for this
-	adc_disable_external_trigger_regular(ADC1);   // We don't need to externally trigger the register...
-	adc_set_right_aligned(ADC1);  // Make sure it is right aligned to get more usable values
-	adc_set_sample_time_on_all_channels(ADC1, ADC_SMPR_SMP_61DOT5CYC);  // Set up sample time
-	adc_set_resolution(ADC1, ADC_CFGR1_RES_12_BIT);  // Get a good resolution
+	for (stage = 0; stage < PROFILE_STAGES; stage++)
+	{
+		volatile struct profileStats* stats = &profileStats[stage];
+		uint32_t count = stats->count;
+		int valid = count < PROFILE_RING_SIZE ? count : PROFILE_RING_SIZE;
 
-	adc_power_on(ADC1);  // Finished setup, turn on ADC register 1
+		putU32(out, count);
+		putU32(out + 4, count ? stats->min : 0);
+		putU32(out + 8, stats->max);
+		putU32(out + 12, count ? stats->total / count : 0);
+		putU32(out + 16, valid ? profilePercentile(stats->samples, valid, 99) : 0);
+		for (i = 0; i < PROFILE_RING_SIZE; i++)
+		{
+			putU32(out + 20 + 4 * i, i < valid ? stats->samples[i] : 0);
+		}
+		out += PROFILE_STAGE_SIZE;
+
+		// Start a new window
+		stats->count = 0;
+		stats->max = 0;
+		stats->total = 0;
+	}
+
+	halWriteTelemetry(profileRecordBuffer, PROFILE_RECORD_SIZE);
+}
+
+void profileTick(void)
+// Called once per game tick; sends a telemetry record every PROFILE_DUMP_TICKS ticks
+{
+	if (++profileTicksSinceDump == PROFILE_DUMP_TICKS)
+	{
+		profileDump();
+		profileTicksSinceDump = 0;
+	}
+}
+#endif
+
+int main(void)
+// Main function to initialise and configure the system, as well as execute the game loop
+{
+	halInit();
+	initShiftOut(); // Precompute the shift-out register patterns
+#if INPUT_STATS
+	measureBlockingReads(); // While the ADC is still idle
+#endif
+	halStartJoySticks(joyStickSamples, JOYSTICK_OVERSAMPLE * 2); // Sample both joysticks continuously in the background
 
-	// Initialise game and display buffer
-	struct pixel frameToDraw[32][32] = {0}; // Buffer for the display
-    struct gameInfo gameInfo = {0,0,15,15,0,1}; // initalise game state (arbitrary values)
+	// Initialise game state and start refreshing the display in the background
+    struct gameInfo gameInfo = {0,0,DISPLAY_WIDTH/2-1,DISPLAY_HEIGHT/2-1,0,1,0,0}; // initalise game state (arbitrary values), 0-0
+	uint32_t replayTicks = loadReplay(&gameInfo); // Ticks of recorded input to play back before the joysticks take over
+	initScanner();
+	initScheduler(); // Start the game tick interrupt
+#if PROFILE
+	halStartTelemetry();
+#endif
+#if STREAM_MODE
+	streamFrames(); // Act as a display for frames sent by a host instead of playing
+#endif
+
+#if ATTRACT_MODE
+	// Play the attract loop until someone moves a joystick, unless the CPU plays both sides and the game
+	// is the demo. The game's first renderFrame redraws both buffers from scratch, since neither has
+	// been rendered by it yet.
+	int attractTick = 0;
+	while (CPU_PLAYERS != 3 && !replayTicks && !readValueFromJoyStick(0) && !readValueFromJoyStick(1))
+	{
+		attractTick += waitForTicks(); // Skip animation frames rather than slow down after a late one
+		drawAttractFrame(backBuffer, attractTick);
+		swapBuffers();
+#if PROFILE
+		profileTick();
+#endif
+	}
+#endif
 
 	while (1)
 	{
-		for (volatile unsigned int tmr= 1e6/50; tmr > 0 ; tmr--); // Sleep briefly
-
-		// Update the game state
-		 moveBallVertical(&gameInfo);
-		 moveBallHorizontal(&gameInfo);
-		 movePaddle(0,&gameInfo);
-		 movePaddle(1,&gameInfo);
-
-		// Update the display buffer
-		 clearScreen(frameToDraw);
-		 drawBallToScreen(frameToDraw, gameInfo.ballXCoordinate, gameInfo.ballYCoordinate);
-		 drawPaddlesToScreen(frameToDraw, gameInfo.paddle1Position, gameInfo.paddle2Position);
-		
-		// Display the updated frame row by row
-		for (i = 0; i < 16; i++) 
-		{	
-			gpio_clear(GPIOC, LATCH); // Disable memory output temporarily
+		int ticks = waitForTicks(); // Sleep until the next game tick, or catch up on late ones
 
-			// Push data for the current row and its mirrored row
-			pushToRow(i, frameToDraw[i+16]);
-			pushToRow(i, frameToDraw[i]);
+		// Update the game state from the replay while it lasts, then from the joysticks
+		PROFILE_START(game);
+		 while (ticks--) stepGame(&gameInfo, nextInput(&replayTicks, &gameInfo));
+		PROFILE_END(PROFILE_GAME, game);
 
-			selectRow(i); // Select the row to display
+		// Bring the back buffer up to date, redrawing only the rows that changed since it was last shown
+		PROFILE_START(render);
+		 renderFrame(backBuffer, &bufferContents[backBuffer - frameBuffers], &gameInfo);
+		PROFILE_END(PROFILE_RENDER, render);
 
-			gpio_set(GPIOC, LATCH); // Enable memory output to show changes
-		}
+		// Show it from the next refresh onwards
+		PROFILE_START(vsync);
+		 swapBuffers();
+		PROFILE_END(PROFILE_VSYNC, vsync);
+
+#if PROFILE
+		profileTick();
+#endif
 	}
 }
@@ -0,0 +1,359 @@
+// Headless simulator: steps many games at once with no display, delays or hardware, for checking
+// rule changes and tuning difficulty. It takes the game rules, replay format and random generator
+// from LEDPanel.c, built for the host backend, and has its own main.
+//
+//     gcc -O3 -march=native sim/sim.c -o ledpanel-sim -lpthread
+//
+// Settings come from the environment:
+// LEDPANEL_SIM_GAMES      games to run side by side (default 1024)
+// LEDPANEL_SIM_TICKS      ticks to run each game for (default 100000)
+// LEDPANEL_SIM_THREADS    worker threads (default: one per online CPU)
+// LEDPANEL_SIM_SEED       seed for the starting states and scripted players (default 1)
+// LEDPANEL_SIM_SKILL      percentage of ticks a scripted player moves towards the ball (default 90)
+// LEDPANEL_SIM_INPUT      replay file whose start and inputs drive every game instead of the script
+// LEDPANEL_SIM_RECORD     replay file to write for one game, to play back on the panel
+// LEDPANEL_SIM_RECORD_GAME  which game to record (default 0)
+// LEDPANEL_SIM_CHECK      1 = re-run every game through stepGame and count any that end differently
+
+#define LEDPANEL_HOST
+#define main ledPanelMain // The simulator has its own main
+#include "../LEDPanel.c"
+#undef main
+
+#include <pthread.h>
+
+#define SIM_BLOCK 256 // Games stepped together, sized so their state stays in the L1 cache
+
+struct simBlock
+// SIM_BLOCK games' state laid out field by field, so each tick is one pass along a few arrays
+{
+	int16_t ballX[SIM_BLOCK];
+	int16_t ballY[SIM_BLOCK];
+	int16_t ballXDirection[SIM_BLOCK];
+	int16_t ballYDirection[SIM_BLOCK];
+	int16_t paddle1[SIM_BLOCK];
+	int16_t paddle2[SIM_BLOCK];
+	uint32_t random[SIM_BLOCK]; // State of each game's scripted players
+	uint32_t misses1[SIM_BLOCK]; // Balls player 1 has let past
+	uint32_t misses2[SIM_BLOCK];
+	uint32_t hits[SIM_BLOCK]; // Balls returned by either paddle
+};
+
+struct simWorker
+// One thread's share of the blocks
+{
+	pthread_t thread;
+	int first;
+	int last;
+	double seconds; // CPU time the thread took
+};
+
+struct simBlock* simBlocks; // Game i is entry i % SIM_BLOCK of block i / SIM_BLOCK
+uint32_t simTicks;
+int simSkill; // Out of 256
+const uint8_t* simInputs; // Recorded input for every game, or NULL for the scripted players
+
+static inline int simChase(uint32_t random, int ballY, int paddle)
+// A scripted player's direction, from 16 random bits: usually towards the ball, otherwise random.
+// Comparisons are used as 0/1 values and masks rather than branches, so blocks can vectorise.
+{
+	int target = ballY - PADDLELENGTH / 2; // Paddle position that centres it on the ball
+	int towards = (target < paddle) - (target > paddle);
+	int wander = (int)((((random >> 8) & 255) * 3) >> 8) - 1; // -1, 0 or 1
+	int chase = -((int)(random & 255) < simSkill); // All ones to move towards the ball
+	return (towards & chase) | (wander & ~chase);
+}
+
+static inline int simDirection(uint8_t input, int player1Or2)
+// inputDirection without branches
+{
+	int code = input >> (2 * player1Or2);
+	return (code & 1) - ((code >> 1) & 1);
+}
+
+void simStartGame(uint32_t seed, int index, struct gameInfo* game, uint32_t* random)
+// Works out a game's starting state and player seed from the run's seed and the game's number
+{
+	uint32_t state = seed * 0x9E3779B9u ^ (uint32_t)index * 0x85EBCA6Bu;
+	int i;
+
+	for (i = 0; i < 4; i++) state = randomNext(state | 1);
+
+	game->paddle1Position = state % (DISPLAY_HEIGHT - PADDLELENGTH);
+	game->paddle2Position = (state >> 8) % (DISPLAY_HEIGHT - PADDLELENGTH);
+	game->ballXCoordinate = 2 + (state >> 16) % (DISPLAY_WIDTH - 4); // Anywhere between the paddles
+	state = randomNext(state);
+	game->ballYCoordinate = state % DISPLAY_HEIGHT;
+	game->ballXDirection = (state >> 8) & 1;
+	game->ballYDirection = (state >> 9) & 1;
+	game->score1 = 0;
+	game->score2 = 0;
+	*random = randomNext(state);
+}
+
+void simStepBlock(struct simBlock* block, uint32_t ticks)
+// Runs a block of games for the given number of ticks, following the same rules as stepGame.
+// The rules are written without branches so the compiler can step several games per instruction.
+{
+	int scripted = !simInputs;
+	uint32_t t;
+	int i;
+
+	for (t = 0; t < ticks; t++)
+	{
+		uint8_t recorded = scripted ? 0 : simInputs[t];
+
+		for (i = 0; i < SIM_BLOCK; i++)
+		{
+			int x = block->ballX[i];
+			int y = block->ballY[i];
+			int dx = block->ballXDirection[i];
+			int dy = block->ballYDirection[i];
+			int p1 = block->paddle1[i];
+			int p2 = block->paddle2[i];
+
+			// Inputs are decided from the state at the start of the tick. The scripted players'
+			// generator runs either way, to keep the loop free of branches.
+			uint32_t random = randomNext(block->random[i]);
+			block->random[i] = random;
+			int d1 = scripted ? simChase(random, y, p1) : simDirection(recorded, 0);
+			int d2 = scripted ? simChase(random >> 16, y, p2) : simDirection(recorded, 1);
+
+			// moveBallVertical: bounce off the top and bottom rows
+			dy ^= dy ? y == 0 : y == DISPLAY_HEIGHT - 1;
+			y += 1 - 2 * dy;
+
+			// moveBallHorizontal: bounce off a paddle, or re-centre after passing one
+			int paddle = dx ? p2 : p1;
+			int beyond = dx ? x > DISPLAY_WIDTH - 2 : x < 1;
+			int hit = (x == (dx ? DISPLAY_WIDTH - 2 : 1)) & (y >= paddle) & (y <= paddle + PADDLELENGTH);
+			block->misses1[i] += beyond & !dx;
+			block->misses2[i] += beyond & dx;
+			block->hits[i] += hit;
+			dx ^= beyond | hit;
+			x = beyond ? DISPLAY_WIDTH / 2 - 1 : x + 2 * dx - 1;
+
+			// movePaddle for each player
+			p1 += ((d1 == -1) & (p1 != DISPLAY_HEIGHT - 1 - PADDLELENGTH)) - ((d1 == 1) & (p1 != 0));
+			p2 += ((d2 == -1) & (p2 != DISPLAY_HEIGHT - 1 - PADDLELENGTH)) - ((d2 == 1) & (p2 != 0));
+
+			block->ballX[i] = x;
+			block->ballY[i] = y;
+			block->ballXDirection[i] = dx;
+			block->ballYDirection[i] = dy;
+			block->paddle1[i] = p1;
+			block->paddle2[i] = p2;
+		}
+	}
+}
+
+void* simWorkerRun(void* argument)
+{
+	struct simWorker* worker = argument;
+	struct timespec start;
+	struct timespec end;
+	int b;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+	for (b = worker->first; b < worker->last; b++) simStepBlock(&simBlocks[b], simTicks);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+	worker->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	return NULL;
+}
+
+void simReferenceGame(const struct gameInfo* start, uint32_t random, struct gameInfo* game, uint8_t* record)
+// Plays one game again a tick at a time through stepGame, optionally recording its inputs
+{
+	uint32_t t;
+
+	*game = *start;
+	for (t = 0; t < simTicks; t++)
+	{
+		uint8_t input;
+		if (simInputs) input = simInputs[t];
+		else
+		{
+			random = randomNext(random);
+			input = packInput(simChase(random, game->ballYCoordinate, game->paddle1Position),
+				simChase(random >> 16, game->ballYCoordinate, game->paddle2Position));
+		}
+		if (record) record[t] = input;
+		stepGame(game, input);
+	}
+}
+
+void simWriteReplay(const char* path, const struct gameInfo* start, const uint8_t* inputs, uint32_t ticks)
+// Writes a replay file in the format parseReplayHeader reads
+{
+	uint8_t header[REPLAY_HEADER_SIZE];
+	FILE* file = fopen(path, "wb");
+
+	if (!file)
+	{
+		perror(path);
+		exit(1);
+	}
+	putU16(header, REPLAY_MAGIC);
+	header[2] = REPLAY_VERSION;
+	header[3] = PADDLELENGTH;
+	putU16(header + 4, DISPLAY_WIDTH);
+	putU16(header + 6, DISPLAY_HEIGHT);
+	putU32(header + 8, ticks);
+	putU16(header + 12, start->paddle1Position);
+	putU16(header + 14, start->paddle2Position);
+	putU16(header + 16, start->ballXCoordinate);
+	putU16(header + 18, start->ballYCoordinate);
+	putU16(header + 20, start->ballXDirection);
+	putU16(header + 22, start->ballYDirection);
+	fwrite(header, 1, REPLAY_HEADER_SIZE, file);
+	fwrite(inputs, 1, ticks, file);
+	fclose(file);
+}
+
+uint8_t* simReadReplay(const char* path, struct gameInfo* start, uint32_t* ticks)
+// Loads a whole replay file, returning its inputs
+{
+	uint8_t header[REPLAY_HEADER_SIZE];
+	FILE* file = fopen(path, "rb");
+	uint8_t* inputs;
+
+	if (!file)
+	{
+		perror(path);
+		exit(1);
+	}
+	if (fread(header, 1, REPLAY_HEADER_SIZE, file) != REPLAY_HEADER_SIZE || !(*ticks = parseReplayHeader(header, start)))
+	{
+		fprintf(stderr, "%s: not a replay for a %dx%d display\n", path, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+		exit(1);
+	}
+	inputs = malloc(*ticks);
+	*ticks = fread(inputs, 1, *ticks, file); // Play what there is of a truncated file
+	fclose(file);
+	return inputs;
+}
+
+long simSetting(const char* name, long fallback)
+{
+	const char* value = getenv(name);
+	return value ? strtol(value, NULL, 10) : fallback;
+}
+
+int main(void)
+// Runs the batch described by the LEDPANEL_SIM_* settings and reports the results and throughput
+{
+	int games = simSetting("LEDPANEL_SIM_GAMES", 1024);
+	int threads = simSetting("LEDPANEL_SIM_THREADS", sysconf(_SC_NPROCESSORS_ONLN));
+	uint32_t seed = simSetting("LEDPANEL_SIM_SEED", 1);
+	int recordGame = simSetting("LEDPANEL_SIM_RECORD_GAME", 0);
+	int check = simSetting("LEDPANEL_SIM_CHECK", 0);
+	const char* inputPath = getenv("LEDPANEL_SIM_INPUT");
+	const char* recordPath = getenv("LEDPANEL_SIM_RECORD");
+	struct gameInfo replayStart;
+	struct simWorker* workers;
+	struct timespec start;
+	struct timespec end;
+	double cpuSeconds = 0;
+	uint64_t misses1 = 0;
+	uint64_t misses2 = 0;
+	uint64_t hits = 0;
+	int blocks;
+	int i;
+
+	simTicks = simSetting("LEDPANEL_SIM_TICKS", 100000);
+	simSkill = simSetting("LEDPANEL_SIM_SKILL", 90) * 256 / 100;
+	if (inputPath) simInputs = simReadReplay(inputPath, &replayStart, &simTicks);
+	if (games < 1) games = 1;
+	if (recordGame < 0 || recordGame >= games) recordGame = 0;
+
+	// The last block is filled up with extra games, which are stepped but not reported
+	blocks = (games + SIM_BLOCK - 1) / SIM_BLOCK;
+	simBlocks = calloc(blocks, sizeof(struct simBlock));
+	for (i = 0; i < blocks * SIM_BLOCK; i++)
+	{
+		struct simBlock* block = &simBlocks[i / SIM_BLOCK];
+		int slot = i % SIM_BLOCK;
+		struct gameInfo game;
+
+		simStartGame(seed, i, &game, &block->random[slot]);
+		if (simInputs) game = replayStart;
+		block->ballX[slot] = game.ballXCoordinate;
+		block->ballY[slot] = game.ballYCoordinate;
+		block->ballXDirection[slot] = game.ballXDirection;
+		block->ballYDirection[slot] = game.ballYDirection;
+		block->paddle1[slot] = game.paddle1Position;
+		block->paddle2[slot] = game.paddle2Position;
+	}
+
+	// Share the blocks out between the threads
+	if (threads > blocks) threads = blocks;
+	if (threads < 1) threads = 1;
+	workers = calloc(threads, sizeof(struct simWorker));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < threads; i++)
+	{
+		workers[i].first = blocks * i / threads;
+		workers[i].last = blocks * (i + 1) / threads;
+		pthread_create(&workers[i].thread, NULL, simWorkerRun, &workers[i]);
+	}
+	for (i = 0; i < threads; i++)
+	{
+		pthread_join(workers[i].thread, NULL);
+		cpuSeconds += workers[i].seconds;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	for (i = 0; i < games; i++)
+	{
+		misses1 += simBlocks[i / SIM_BLOCK].misses1[i % SIM_BLOCK];
+		misses2 += simBlocks[i / SIM_BLOCK].misses2[i % SIM_BLOCK];
+		hits += simBlocks[i / SIM_BLOCK].hits[i % SIM_BLOCK];
+	}
+
+	// Throughput counts every game stepped, including the ones filling up the last block
+	double wallSeconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	double steppedTicks = (double)blocks * SIM_BLOCK * simTicks;
+	double gameTicks = (double)games * simTicks;
+	const struct simBlock* recorded = &simBlocks[recordGame / SIM_BLOCK];
+	int slot = recordGame % SIM_BLOCK;
+
+	printf("%d games x %u ticks on %d threads in %.3f s\n", games, simTicks, threads, wallSeconds);
+	printf("throughput %.1f M ticks/s, %.1f M ticks/s per core\n",
+		steppedTicks / wallSeconds / 1e6, cpuSeconds ? steppedTicks / cpuSeconds / 1e6 : 0);
+	printf("per game: player 1 missed %.1f, player 2 missed %.1f, %.1f returns, %.1f ticks per point\n",
+		(double)misses1 / games, (double)misses2 / games, (double)hits / games,
+		misses1 + misses2 ? gameTicks / (misses1 + misses2) : 0);
+	printf("game %d ends with ball (%d,%d), paddles %d and %d, misses %u-%u\n", recordGame,
+		recorded->ballX[slot], recorded->ballY[slot], recorded->paddle1[slot], recorded->paddle2[slot],
+		recorded->misses1[slot], recorded->misses2[slot]);
+
+	if (check || recordPath)
+	{
+		uint8_t* record = recordPath ? malloc(simTicks) : NULL;
+		int mismatches = 0;
+		int checked = 0;
+
+		for (i = 0; i < games; i++)
+		{
+			const struct simBlock* block = &simBlocks[i / SIM_BLOCK];
+			struct gameInfo begin;
+			struct gameInfo game;
+			uint32_t random;
+
+			if (i != recordGame && !check) continue;
+			slot = i % SIM_BLOCK;
+			simStartGame(seed, i, &begin, &random);
+			if (simInputs) begin = replayStart;
+			simReferenceGame(&begin, random, &game, i == recordGame ? record : NULL);
+			checked++;
+			if (game.ballXCoordinate != block->ballX[slot] || game.ballYCoordinate != block->ballY[slot]
+				|| game.ballXDirection != block->ballXDirection[slot] || game.ballYDirection != block->ballYDirection[slot]
+				|| game.paddle1Position != block->paddle1[slot] || game.paddle2Position != block->paddle2[slot]
+				|| game.score1 != (int)block->misses2[slot] || game.score2 != (int)block->misses1[slot]) mismatches++;
+			if (i == recordGame && recordPath) simWriteReplay(recordPath, &begin, record, simTicks);
+		}
+		printf("%d of %d games checked against stepGame ended differently\n", mismatches, checked);
+		if (mismatches) return 1;
+	}
+	return 0;
+}
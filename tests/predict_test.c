@@ -0,0 +1,134 @@
+// Host test: predictBall against stepping the ball through the game rules.
+//
+// For every ball position and direction on the display and both players, predictBall's row and
+// tick count must match stepping a copy of the ball through moveBallVertical and moveBallHorizontal,
+// with every paddle test hit, until it reaches that player's paddle column. The test then times both
+// methods and plays the CPU against itself for CPU_TEST_TICKS ticks to show how often each side misses.
+//
+//     gcc -O2 tests/predict_test.c -o predict-test && ./predict-test
+//
+// Any geometry or CPU option LEDPanel.c accepts can be given with -D, e.g. -DCPU_ERROR_ROWS=8.
+// Exits with 1 if any prediction differs.
+
+#define LEDPANEL_HOST
+#define main ledPanelMain // The test has its own main
+#include "../LEDPanel.c"
+#undef main
+
+#ifndef CPU_TEST_TICKS
+#define CPU_TEST_TICKS 100000 // Ticks of CPU against CPU
+#endif
+
+int main(void)
+// Compares predictBall with stepping a copy of the ball through moveBallVertical and
+// moveBallHorizontal, for every ball position and direction and both players, with every paddle
+// test hit, then times both and plays the CPU against itself.
+{
+	struct timespec start;
+	struct timespec end;
+	struct gameInfo game = {0};
+	struct ballState ball;
+	uint64_t predictions = 0;
+	uint64_t steps = 0;
+	double predictSeconds;
+	double stepSeconds;
+	volatile int sink = 0; // Keeps the timed loops from being optimised away
+	int mismatches = 0;
+	int player;
+	int x;
+	int y;
+	int direction;
+	int ticks;
+	uint32_t t;
+
+	for (player = 0; player < 2; player++)
+	{
+		int column = player ? DISPLAY_WIDTH - 2 : 1;
+		for (x = 0; x < DISPLAY_WIDTH; x++)
+		for (y = 0; y < DISPLAY_HEIGHT; y++)
+		for (direction = 0; direction < 4; direction++)
+		{
+			int predicted;
+			int stepped = 0;
+
+			ball.ballXCoordinate = game.ballXCoordinate = x;
+			ball.ballYCoordinate = game.ballYCoordinate = y;
+			ball.ballXDirection = game.ballXDirection = direction & 1;
+			ball.ballYDirection = game.ballYDirection = direction >> 1;
+			predicted = predictBall(&ball, player, &ticks);
+			for (;;)
+			{
+				stepped++;
+				moveBallVertical(&game);
+				if (game.ballXCoordinate == column && game.ballXDirection == player) break; // This tick tests the paddle
+				game.paddle1Position = game.ballYCoordinate; // Return the ball whichever paddle it reaches
+				game.paddle2Position = game.ballYCoordinate;
+				moveBallHorizontal(&game);
+			}
+			if (predicted != game.ballYCoordinate || ticks != stepped)
+			{
+				if (mismatches++ < 10) printf("player %d, ball (%d,%d) going %s and %s: predicted row %d after %d ticks, stepped to row %d after %d\n",
+					player + 1, x, y, direction & 1 ? "right" : "left", direction >> 1 ? "up" : "down", predicted, ticks, game.ballYCoordinate, stepped);
+			}
+		}
+	}
+	printf("%d of %d predictions differ from stepping the ball\n", mismatches, 2 * DISPLAY_WIDTH * DISPLAY_HEIGHT * 4);
+
+	// Time predictBall against stepping ahead, over the same states
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (t = 0; t < 64; t++)
+	for (x = 0; x < DISPLAY_WIDTH; x++)
+	for (y = 0; y < DISPLAY_HEIGHT; y++)
+	{
+		ball.ballXCoordinate = x;
+		ball.ballYCoordinate = y;
+		ball.ballXDirection = t & 1;
+		ball.ballYDirection = (t >> 1) & 1;
+		sink += predictBall(&ball, (t >> 2) & 1, &ticks);
+		predictions++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	predictSeconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (x = 0; x < DISPLAY_WIDTH; x++)
+	for (y = 0; y < DISPLAY_HEIGHT; y++)
+	{
+		game.ballXCoordinate = x;
+		game.ballYCoordinate = y;
+		game.ballXDirection = 0;
+		game.ballYDirection = 0;
+		do
+		{
+			moveBallVertical(&game);
+			game.paddle1Position = game.ballYCoordinate;
+			game.paddle2Position = game.ballYCoordinate;
+			if (game.ballXCoordinate == 1 && !game.ballXDirection) break;
+			moveBallHorizontal(&game);
+			steps++;
+		} while (1);
+		sink += game.ballYCoordinate;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	stepSeconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("predictBall %.1f ns per prediction, stepping ahead %.1f ns per prediction (%.1f ticks on average)\n",
+		predictSeconds * 1e9 / predictions, stepSeconds * 1e9 / (DISPLAY_WIDTH * DISPLAY_HEIGHT),
+		(double)steps / (DISPLAY_WIDTH * DISPLAY_HEIGHT));
+
+	// Play the CPU against itself, both paddles at the configured reaction and error
+	game.ballXCoordinate = DISPLAY_WIDTH / 2 - 1;
+	game.ballYCoordinate = DISPLAY_HEIGHT / 2 - 1;
+	game.ballXDirection = 0;
+	game.ballYDirection = 1;
+	game.paddle1Position = 0;
+	game.paddle2Position = 0;
+	game.score1 = 0;
+	game.score2 = 0;
+	cpuTicks = 0;
+	for (t = 0; t < CPU_TEST_TICKS; t++)
+	{
+		stepGame(&game, cpuInput(&game, 0, 3));
+	}
+	printf("CPU against CPU (reaction %d ticks, error %d rows): %d-%d over %u ticks\n",
+		CPU_REACTION_TICKS, CPU_ERROR_ROWS, game.score1, game.score2, CPU_TEST_TICKS);
+	return mismatches ? 1 : 0;
+}
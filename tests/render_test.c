@@ -0,0 +1,220 @@
+// Host test: the packed frame buffer renderer against the original struct pixel renderer.
+//
+// Plays a scripted game and, every tick, draws the frame both ways: the original clear, ball and
+// paddle drawing into an array of struct pixel, and renderFrame into double-buffered packed frame
+// buffers as main does. The pixels must match. Each frame is then shifted out through the emulated
+// panel twice, once a pixel at a time as the original pushToRow did and once by pushToRow from the
+// packed planes, and what the panel latches must match too.
+//
+//     gcc -O2 tests/render_test.c -o render-test && ./render-test
+//
+// Any geometry or colour depth LEDPanel.c accepts can be given with -D, e.g. -DPANEL_CHAIN=6.
+// The original renderer had no scores, so they are left out unless built with -DSCORE_OVERLAY=1,
+// in which case the reference plots them pixel by pixel under the ball and paddles as renderFrame
+// layers them. Exits with 1 at the first frame that differs.
+
+#define LEDPANEL_HOST
+#ifndef SCORE_OVERLAY
+#define SCORE_OVERLAY 0
+#endif
+#define ATTRACT_MODE 0
+#define main ledPanelMain // The test has its own main
+#include "../LEDPanel.c"
+#undef main
+
+#define TEST_TICKS 20000
+
+struct pixel referenceScreen[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+struct bitPlane referencePanel; // What the panel latched from the original shift-out
+
+void referenceClearScreen(struct pixel screen[DISPLAY_HEIGHT][DISPLAY_WIDTH])
+// The original clearScreen: every pixel set to blank
+{
+	int i;
+	int j;
+	for (i = 0; i < DISPLAY_HEIGHT; i++)
+	{
+		for (j = 0; j < DISPLAY_WIDTH; j++)
+		{
+			screen[i][j] = blank;
+		}
+	}
+}
+
+void referenceDrawPaddles(struct pixel screen[DISPLAY_HEIGHT][DISPLAY_WIDTH], int paddle1Position, int paddle2Position)
+// The original drawPaddlesToScreen, one pixel at a time
+{
+	int i;
+	for (i = paddle1Position; i < paddle1Position + PADDLELENGTH; i++)
+	{
+		screen[i][0] = red;
+	}
+	for (i = paddle2Position; i < paddle2Position + PADDLELENGTH; i++)
+	{
+		screen[i][DISPLAY_WIDTH - 1] = blue;
+	}
+}
+
+void referenceDrawBall(struct pixel screen[DISPLAY_HEIGHT][DISPLAY_WIDTH], int ballXPosition, int ballYPosition)
+// The original drawBallToScreen
+{
+	screen[ballYPosition][ballXPosition] = white;
+}
+
+void referenceDrawText(struct pixel screen[DISPLAY_HEIGHT][DISPLAY_WIDTH], int x, int y, const char* text, struct pixel colour)
+// Plots each lit pixel of each font3x5 glyph on the display, one at a time
+{
+	int i;
+	int row;
+	int column;
+	for (i = 0; text[i]; i++)
+	{
+		const uint8_t* glyph = font3x5.rows + (text[i] - font3x5.first) * font3x5.height;
+		for (row = 0; row < font3x5.height; row++)
+		{
+			for (column = 0; column < font3x5.width; column++)
+			{
+				int screenX = x + i * (font3x5.width + 1) + column;
+				if ((glyph[row] >> column) & 1 && screenX >= 0 && screenX < DISPLAY_WIDTH && y + row < DISPLAY_HEIGHT)
+				{
+					screen[y + row][screenX] = colour;
+				}
+			}
+		}
+	}
+}
+
+void referenceDrawScore(struct pixel screen[DISPLAY_HEIGHT][DISPLAY_WIDTH], int score1, int score2)
+// Player 1's score ends a column left of the centre line and player 2's starts a column right of it
+{
+	char text[12];
+	int length = snprintf(text, sizeof text, "%d", score1);
+	referenceDrawText(screen, DISPLAY_WIDTH / 2 - 1 - (length * (font3x5.width + 1) - 1), SCOREROW, text, red);
+	snprintf(text, sizeof text, "%d", score2);
+	referenceDrawText(screen, DISPLAY_WIDTH / 2 + 1, SCOREROW, text, blue);
+}
+
+void referenceShiftPixels(const struct pixel* pixels, int plane)
+// The original pushToRow for one panel's share of a row: blue, green then red, a pin write per
+// change, sending bit plane of each channel
+{
+	int channel;
+	int i;
+	for (channel = 2; channel >= 0; channel--)
+	{
+		for (i = 0; i < PANEL_WIDTH; i++)
+		{
+			int value = channel == 2 ? pixels[i].blue : channel == 1 ? pixels[i].green : pixels[i].red;
+			halClearPins(CLOCK);
+			if ((value >> plane) & 1) halSetPins(INPUTSIGNAL);
+			else halClearPins(INPUTSIGNAL);
+			halSetPins(CLOCK);
+		}
+	}
+}
+
+void showReference(int plane)
+// Shifts every row address of the reference screen into the emulated panel the original way
+{
+	int row;
+	int panel;
+	for (row = 0; row < SCAN_ROWS; row++)
+	{
+		halClearPins(LATCH);
+		for (panel = 0; panel < PANEL_CHAIN; panel++)
+		{
+			referenceShiftPixels(&referenceScreen[row + SCAN_ROWS][panel * PANEL_WIDTH], plane);
+			referenceShiftPixels(&referenceScreen[row][panel * PANEL_WIDTH], plane);
+		}
+		selectRow(row);
+		halSetPins(LATCH);
+	}
+}
+
+void showPacked(const struct frameBuffer* screen, int plane)
+// Shifts every row address of a packed frame buffer into the emulated panel, as scanNextRow does
+{
+	int row;
+	for (row = 0; row < SCAN_ROWS; row++)
+	{
+		halClearPins(LATCH);
+		pushToRow(row, &screen->plane[plane]);
+		selectRow(row);
+		halSetPins(LATCH);
+	}
+}
+
+int pixelsMatch(const struct frameBuffer* screen)
+// Compares every pixel of a packed frame buffer with the reference screen
+{
+	int x;
+	int y;
+	int b;
+	for (y = 0; y < DISPLAY_HEIGHT; y++)
+	{
+		for (x = 0; x < DISPLAY_WIDTH; x++)
+		{
+			struct pixel packed = {0, 0, 0};
+			uint32_t bit = (uint32_t)1 << (x % 32);
+			for (b = 0; b < COLOUR_DEPTH; b++)
+			{
+				packed.red |= ((screen->plane[b].red[y][x / 32] & bit) != 0) << b;
+				packed.green |= ((screen->plane[b].green[y][x / 32] & bit) != 0) << b;
+				packed.blue |= ((screen->plane[b].blue[y][x / 32] & bit) != 0) << b;
+			}
+			if (packed.red != referenceScreen[y][x].red || packed.green != referenceScreen[y][x].green
+				|| packed.blue != referenceScreen[y][x].blue)
+			{
+				printf("pixel (%d,%d) is %d,%d,%d, the original renderer gives %d,%d,%d\n", x, y,
+					packed.red, packed.green, packed.blue,
+					referenceScreen[y][x].red, referenceScreen[y][x].green, referenceScreen[y][x].blue);
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+int main(void)
+{
+	struct gameInfo game = {0, 0, DISPLAY_WIDTH / 2 - 1, DISPLAY_HEIGHT / 2 - 1, 0, 1, 0, 0};
+	uint32_t random = 1;
+	int tick;
+	int b;
+
+	initShiftOut();
+	for (tick = 0; tick < TEST_TICKS; tick++)
+	{
+		struct frameBuffer* screen = &frameBuffers[tick & 1]; // Alternate buffers as swapBuffers does
+
+		random = randomNext(random);
+		stepGame(&game, packInput((int)(random % 3) - 1, (int)((random >> 8) % 3) - 1));
+
+		referenceClearScreen(referenceScreen);
+		if (SCORE_OVERLAY) referenceDrawScore(referenceScreen, game.score1, game.score2);
+		referenceDrawBall(referenceScreen, game.ballXCoordinate, game.ballYCoordinate);
+		referenceDrawPaddles(referenceScreen, game.paddle1Position, game.paddle2Position);
+		renderFrame(screen, &bufferContents[tick & 1], &game);
+
+		if (!pixelsMatch(screen))
+		{
+			printf("frame %d differs\n", tick);
+			return 1;
+		}
+
+		for (b = 0; b < COLOUR_DEPTH; b++)
+		{
+			showReference(b);
+			referencePanel = hostPanel;
+			showPacked(screen, b);
+			if (memcmp(&referencePanel, &hostPanel, sizeof hostPanel))
+			{
+				printf("frame %d, plane %d: the panel shows something else after pushToRow\n", tick, b);
+				return 1;
+			}
+		}
+	}
+	printf("%d frames of a %dx%d display at %d bits per colour%s match the original renderer (%d-%d)\n",
+		TEST_TICKS, DISPLAY_WIDTH, DISPLAY_HEIGHT, COLOUR_DEPTH, SCORE_OVERLAY ? " with scores" : "", game.score1, game.score2);
+	return 0;
+}
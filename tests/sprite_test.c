@@ -0,0 +1,138 @@
+// Host test: drawSprite's clipping against a pixel-by-pixel decode of the same sprite.
+//
+// Draws every frame of the pompompurin sprite at every position from entirely off the top left of
+// the display to entirely off its bottom right, over a frame buffer filled with random pixels. Every
+// pixel must then match decoding the runs one pixel at a time and drawing the ones on the display:
+// opaque pixels take the palette colour, and transparent and off-sprite pixels keep the background.
+//
+//     gcc -O2 tests/sprite_test.c -o sprite-test && ./sprite-test
+//
+// Any geometry or colour depth LEDPanel.c accepts can be given with -D, e.g. -DPANEL_CHAIN=6.
+// Exits with 1 at the first placement that differs.
+
+#define LEDPANEL_HOST
+#define main ledPanelMain // The test has its own main
+#include "../LEDPanel.c"
+#undef main
+
+struct frameBuffer testScreen;
+struct pixel referenceScreen[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+
+struct pixel readPixel(const struct frameBuffer* screen, int x, int y)
+// Gathers one pixel's channels from the bit planes
+{
+	struct pixel pixel = {0, 0, 0};
+	uint32_t bit = (uint32_t)1 << (x % 32);
+	int b;
+	for (b = 0; b < COLOUR_DEPTH; b++)
+	{
+		pixel.red |= ((screen->plane[b].red[y][x / 32] & bit) != 0) << b;
+		pixel.green |= ((screen->plane[b].green[y][x / 32] & bit) != 0) << b;
+		pixel.blue |= ((screen->plane[b].blue[y][x / 32] & bit) != 0) << b;
+	}
+	return pixel;
+}
+
+void fillRandom(struct frameBuffer* screen, uint32_t* random)
+// Fills every plane with random pixels and copies them to the reference screen
+{
+	uint32_t* word = (uint32_t*)screen;
+	int x;
+	int y;
+	int i;
+	for (i = 0; i < (int)(sizeof *screen / sizeof *word); i++)
+	{
+		*random = randomNext(*random);
+		word[i] = *random;
+	}
+	for (y = 0; y < DISPLAY_HEIGHT; y++)
+	{
+		for (x = 0; x < DISPLAY_WIDTH; x++)
+		{
+			referenceScreen[y][x] = readPixel(screen, x, y);
+		}
+	}
+}
+
+void referenceDrawSprite(const struct sprite* sprite, int frame, int x, int y)
+// Decodes a sprite frame one pixel at a time, drawing each opaque pixel that lands on the display
+{
+	const uint8_t* run = sprite->data + sprite->frames[frame];
+	int row;
+	int column;
+	int i;
+
+	for (row = 0; row < sprite->height; row++)
+	{
+		column = 0;
+		while (column < sprite->width)
+		{
+			int length = (*run >> 4) + 1;
+			int index = *run & 15;
+			run++;
+			for (i = 0; i < length; i++, column++)
+			{
+				int screenX = x + column;
+				int screenY = y + row;
+				if (!index || screenX < 0 || screenX >= DISPLAY_WIDTH || screenY < 0 || screenY >= DISPLAY_HEIGHT) continue;
+				referenceScreen[screenY][screenX].red = sprite->palette[index].red >> (8 - COLOUR_DEPTH);
+				referenceScreen[screenY][screenX].green = sprite->palette[index].green >> (8 - COLOUR_DEPTH);
+				referenceScreen[screenY][screenX].blue = sprite->palette[index].blue >> (8 - COLOUR_DEPTH);
+			}
+		}
+	}
+}
+
+int screenMatches(void)
+// Compares every pixel of the test screen with the reference screen
+{
+	int x;
+	int y;
+	for (y = 0; y < DISPLAY_HEIGHT; y++)
+	{
+		for (x = 0; x < DISPLAY_WIDTH; x++)
+		{
+			struct pixel drawn = readPixel(&testScreen, x, y);
+			struct pixel expected = referenceScreen[y][x];
+			if (drawn.red != expected.red || drawn.green != expected.green || drawn.blue != expected.blue)
+			{
+				printf("pixel (%d,%d) is %d,%d,%d, decoding pixel by pixel gives %d,%d,%d\n", x, y,
+					drawn.red, drawn.green, drawn.blue, expected.red, expected.green, expected.blue);
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+int main(void)
+{
+	const struct sprite* sprite = &pompompurin;
+	uint32_t random = 1;
+	int placements = 0;
+	int frame;
+	int x;
+	int y;
+
+	for (frame = 0; frame < sprite->frameCount; frame++)
+	{
+		for (y = -sprite->height - 1; y <= DISPLAY_HEIGHT + 1; y++)
+		{
+			for (x = -sprite->width - 1; x <= DISPLAY_WIDTH + 1; x++)
+			{
+				fillRandom(&testScreen, &random);
+				drawSprite(&testScreen, sprite, frame, x, y);
+				referenceDrawSprite(sprite, frame, x, y);
+				if (!screenMatches())
+				{
+					printf("frame %d drawn at (%d,%d) differs\n", frame, x, y);
+					return 1;
+				}
+				placements++;
+			}
+		}
+	}
+	printf("%d placements of a %dx%d sprite on a %dx%d display at %d bits per colour match decoding pixel by pixel\n",
+		placements, sprite->width, sprite->height, DISPLAY_WIDTH, DISPLAY_HEIGHT, COLOUR_DEPTH);
+	return 0;
+}
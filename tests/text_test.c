@@ -0,0 +1,164 @@
+// Host test: drawText's and drawMarquee's clipping against plotting the glyphs pixel by pixel.
+//
+// Draws a short string and a long one at every position from entirely off the top left of the
+// display to entirely off its bottom right, over a frame buffer filled with random pixels, then
+// scrolls the long one through two whole passes of the marquee. Every pixel must match plotting
+// each glyph's lit pixels one at a time, with the background left between them, and drawText must
+// return the number of pixels plotted.
+//
+//     gcc -O2 tests/text_test.c -o text-test && ./text-test
+//
+// Any geometry or colour depth LEDPanel.c accepts can be given with -D, e.g. -DPANEL_CHAIN=6.
+// Exits with 1 at the first placement that differs.
+
+#define LEDPANEL_HOST
+#define main ledPanelMain // The test has its own main
+#include "../LEDPanel.c"
+#undef main
+
+struct frameBuffer testScreen;
+struct pixel referenceScreen[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+
+struct pixel readPixel(const struct frameBuffer* screen, int x, int y)
+// Gathers one pixel's channels from the bit planes
+{
+	struct pixel pixel = {0, 0, 0};
+	uint32_t bit = (uint32_t)1 << (x % 32);
+	int b;
+	for (b = 0; b < COLOUR_DEPTH; b++)
+	{
+		pixel.red |= ((screen->plane[b].red[y][x / 32] & bit) != 0) << b;
+		pixel.green |= ((screen->plane[b].green[y][x / 32] & bit) != 0) << b;
+		pixel.blue |= ((screen->plane[b].blue[y][x / 32] & bit) != 0) << b;
+	}
+	return pixel;
+}
+
+void fillRandom(struct frameBuffer* screen, uint32_t* random)
+// Fills every plane with random pixels and copies them to the reference screen
+{
+	uint32_t* word = (uint32_t*)screen;
+	int x;
+	int y;
+	int i;
+	for (i = 0; i < (int)(sizeof *screen / sizeof *word); i++)
+	{
+		*random = randomNext(*random);
+		word[i] = *random;
+	}
+	for (y = 0; y < DISPLAY_HEIGHT; y++)
+	{
+		for (x = 0; x < DISPLAY_WIDTH; x++)
+		{
+			referenceScreen[y][x] = readPixel(screen, x, y);
+		}
+	}
+}
+
+int referenceDrawText(const struct font* font, int x, int y, const char* text, struct pixel colour)
+// Plots each glyph's lit pixels that land on the display one at a time; returns how many it plotted
+{
+	int pixels = 0;
+	int i;
+	int row;
+	int column;
+
+	for (i = 0; text[i]; i++)
+	{
+		int code = text[i];
+		if (code >= 'a' && code <= 'z') code -= 'a' - 'A';
+		code -= font->first;
+		if (code < 0 || code >= font->count) code = 0;
+
+		for (row = 0; row < font->height; row++)
+		{
+			for (column = 0; column < font->width; column++)
+			{
+				int screenX = x + i * (font->width + 1) + column;
+				int screenY = y + row;
+				if (!((font->rows[code * font->height + row] >> column) & 1)) continue;
+				if (screenX < 0 || screenX >= DISPLAY_WIDTH || screenY < 0 || screenY >= DISPLAY_HEIGHT) continue;
+				referenceScreen[screenY][screenX] = colour;
+				pixels++;
+			}
+		}
+	}
+	return pixels;
+}
+
+int screenMatches(void)
+// Compares every pixel of the test screen with the reference screen
+{
+	int x;
+	int y;
+	for (y = 0; y < DISPLAY_HEIGHT; y++)
+	{
+		for (x = 0; x < DISPLAY_WIDTH; x++)
+		{
+			struct pixel drawn = readPixel(&testScreen, x, y);
+			struct pixel expected = referenceScreen[y][x];
+			if (drawn.red != expected.red || drawn.green != expected.green || drawn.blue != expected.blue)
+			{
+				printf("pixel (%d,%d) is %d,%d,%d, plotting pixel by pixel gives %d,%d,%d\n", x, y,
+					drawn.red, drawn.green, drawn.blue, expected.red, expected.green, expected.blue);
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+int main(void)
+{
+	const char* texts[] = {"Hi 42!~", "MOVE A JOYSTICK TO PLAY"}; // Lower case, and a character the font lacks
+	const struct font* font = &font3x5;
+	struct pixel colour = {COLOUR_MAX, COLOUR_MAX / 2, 1}; // Differs between planes above 1 bit
+	uint32_t random = 1;
+	int placements = 0;
+	int t;
+	int x;
+	int y;
+	int tick;
+
+	for (t = 0; t < (int)(sizeof texts / sizeof texts[0]); t++)
+	{
+		int width = textWidth(font, strlen(texts[t]));
+		for (y = -font->height - 1; y <= DISPLAY_HEIGHT + 1; y++)
+		{
+			for (x = -width - 1; x <= DISPLAY_WIDTH + 1; x++)
+			{
+				int drawn;
+				int expected;
+
+				fillRandom(&testScreen, &random);
+				drawn = drawText(&testScreen, font, x, y, texts[t], colour);
+				expected = referenceDrawText(font, x, y, texts[t], colour);
+				if (!screenMatches() || drawn != expected)
+				{
+					printf("\"%s\" drawn at (%d,%d) differs (%d pixels drawn, %d plotted)\n", texts[t], x, y, drawn, expected);
+					return 1;
+				}
+				placements++;
+			}
+		}
+	}
+
+	// The marquee enters from the right edge and leaves past the left one before starting again
+	for (tick = 0; tick < 2 * (DISPLAY_WIDTH + textWidth(font, strlen(texts[1]))); tick++)
+	{
+		int travel = DISPLAY_WIDTH + textWidth(font, strlen(texts[1]));
+
+		fillRandom(&testScreen, &random);
+		drawMarquee(&testScreen, font, DISPLAY_HEIGHT - font->height - 1, texts[1], tick, colour);
+		referenceDrawText(font, DISPLAY_WIDTH - tick % travel, DISPLAY_HEIGHT - font->height - 1, texts[1], colour);
+		if (!screenMatches())
+		{
+			printf("marquee tick %d differs\n", tick);
+			return 1;
+		}
+	}
+
+	printf("%d text placements and %d marquee ticks on a %dx%d display at %d bits per colour match plotting pixel by pixel\n",
+		placements, tick, DISPLAY_WIDTH, DISPLAY_HEIGHT, COLOUR_DEPTH);
+	return 0;
+}
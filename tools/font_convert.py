@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+"""Converts a text drawing of a bitmap font into the glyph atlas drawn by drawText in LEDPanel.c.
+
+The input holds one block per glyph, separated by blank lines: the character
+on a line of its own (the word 'space' for a space), then one line per row,
+with # for a lit pixel and . for an unlit one. Lines starting with '# ' are
+comments. Every glyph must be the same size, at most 8x8, and the characters
+must run without gaps from the first one.
+
+    python3 tools/font_convert.py --name font3x5 art/font3x5.txt
+
+The generated C goes to stdout, ready to paste into LEDPanel.c.
+
+Format: every glyph is one byte per row, top row first. Bit n of a row is
+column n of the glyph, the same order as the frame buffer's words, so a row
+can be shifted into place and ORed into a word as it is.
+"""
+
+import argparse
+import sys
+
+MAX_SIZE = 8
+
+
+def read_glyphs(path):
+    """Returns a list of (character, rows) in file order, each row a string of # and ."""
+    glyphs = []
+    block = []
+    for line in open(path).read().split("\n") + [""]:
+        line = line.rstrip()
+        if line.startswith("# "):
+            continue
+        if line:
+            block.append(line)
+            continue
+        if block:
+            name, rows = block[0], block[1:]
+            glyphs.append((" " if name == "space" else name, rows))
+            block = []
+    return glyphs
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("font", help="text drawing of the font")
+    parser.add_argument("--name", required=True, help="C identifier for the font")
+    args = parser.parse_args()
+
+    glyphs = read_glyphs(args.font)
+    if not glyphs:
+        sys.exit("%s: no glyphs found" % args.font)
+    width = len(glyphs[0][1][0])
+    height = len(glyphs[0][1])
+    if width > MAX_SIZE or height > MAX_SIZE:
+        sys.exit("glyphs can be at most %dx%d" % (MAX_SIZE, MAX_SIZE))
+
+    first = ord(glyphs[0][0])
+    for index, (char, rows) in enumerate(glyphs):
+        if len(char) != 1 or ord(char) != first + index:
+            sys.exit("glyph %r is out of order: expected %r" % (char, chr(first + index)))
+        if len(rows) != height or any(len(row) != width or set(row) - set("#.") for row in rows):
+            sys.exit("glyph %r is not a %dx%d drawing of # and ." % (char, width, height))
+
+    name = args.name
+    print("// Generated by tools/font_convert.py from %s" % args.font)
+    print("const uint8_t %sRows[] = // %d bytes" % (name, len(glyphs) * height))
+    print("{")
+    for char, rows in glyphs:
+        values = [sum(1 << column for column, pixel in enumerate(row) if pixel == "#") for row in rows]
+        label = {" ": "space", "\\": "backslash"}.get(char, char)  # A trailing backslash would continue the C comment
+        print("\t%s, // %s" % (",".join("0x%02X" % v for v in values), label))
+    print("};")
+    print()
+    print("const struct font %s = {%d, %d, %d, %d, %sRows};" % (name, width, height, first, len(glyphs), name))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+"""Decodes the stage profiler's telemetry records and prints a report.
+
+Build LEDPanel.c with -DPROFILE=1. The board sends a record on USART2 every
+PROFILE_DUMP_TICKS game ticks, and a host build appends records to the file
+named by LEDPANEL_TELEMETRY. Pass that file, a capture of the serial port, or
+'-' for stdin:
+
+    python3 tools/profile_decode.py capture.bin
+    python3 tools/profile_decode.py --per-record /dev/ttyACM0
+
+The record layout is described above profileDump in LEDPanel.c.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x4650
+VERSION = 1
+HEADER = struct.Struct("<HBBHHII")
+STAGE = struct.Struct("<IIIII")
+STAGE_NAMES = ["game", "render", "vsync", "scan", "sprite", "text"]
+
+
+def read_records(data):
+    """Yields (sequence, cycles_per_second, stages) for each record in data.
+    stages is a list of (count, min, max, avg, p99, samples).
+    Bytes before a valid header are skipped, so a capture can start mid-record."""
+    pos = 0
+    while pos + HEADER.size <= len(data):
+        magic, version, stage_count, ring, _, cps, seq = HEADER.unpack_from(data, pos)
+        size = HEADER.size + stage_count * (STAGE.size + 4 * ring)
+        if magic != MAGIC or version != VERSION or pos + size > len(data):
+            pos += 1
+            continue
+        offset = pos + HEADER.size
+        stages = []
+        for _ in range(stage_count):
+            count, lo, hi, avg, p99 = STAGE.unpack_from(data, offset)
+            offset += STAGE.size
+            samples = struct.unpack_from("<%dI" % ring, data, offset)
+            offset += 4 * ring
+            stages.append((count, lo, hi, avg, p99, samples[:min(count, ring)]))
+        yield seq, cps, stages
+        pos += size
+
+
+def micros(cycles, cps):
+    return cycles * 1e6 / cps
+
+
+def histogram(samples, cps, buckets=10, width=40):
+    """Returns text lines of a histogram of samples, bucketed between their min and max."""
+    lo = min(samples)
+    hi = max(samples)
+    step = max(1, (hi - lo + buckets) // buckets)
+    counts = [0] * buckets
+    for sample in samples:
+        counts[min(buckets - 1, (sample - lo) // step)] += 1
+    peak = max(counts)
+    lines = []
+    for i, count in enumerate(counts):
+        start = lo + i * step
+        bar = "#" * (count * width // peak) if peak else ""
+        lines.append("  %10.2f us | %-*s %d" % (micros(start, cps), width, bar, count))
+    return lines
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", help="telemetry capture file, or - for stdin")
+    parser.add_argument("--per-record", action="store_true", help="also print every record's summary")
+    args = parser.parse_args()
+
+    data = sys.stdin.buffer.read() if args.capture == "-" else open(args.capture, "rb").read()
+    records = list(read_records(data))
+    if not records:
+        sys.exit("no telemetry records found")
+
+    # Combine every record's samples and counters per stage
+    cps = records[0][1]
+    totals = {}
+    last_seq = None
+    missing = 0
+    for seq, _, stages in records:
+        if last_seq is not None and seq != last_seq + 1:
+            missing += seq - last_seq - 1
+        last_seq = seq
+        for index, (count, lo, hi, avg, p99, samples) in enumerate(stages):
+            name = STAGE_NAMES[index] if index < len(STAGE_NAMES) else "stage%d" % index
+            total = totals.setdefault(name, {"count": 0, "sum": 0, "min": None, "max": 0, "samples": []})
+            if count:
+                total["count"] += count
+                total["sum"] += avg * count
+                total["min"] = lo if total["min"] is None else min(total["min"], lo)
+                total["max"] = max(total["max"], hi)
+                total["samples"].extend(samples)
+            if args.per_record:
+                print("record %d %-7s count %6d  min %8.1f  avg %8.1f  max %8.1f  p99 %8.1f us"
+                      % (seq, name, count, micros(lo, cps), micros(avg, cps), micros(hi, cps), micros(p99, cps)))
+
+    print("%d records (%d missing), %d cycles per second" % (len(records), missing, cps))
+    for name, total in totals.items():
+        samples = sorted(total["samples"])
+        print()
+        if not total["count"]:
+            print("%s: no samples" % name)
+            continue
+        p99 = samples[max(0, (len(samples) * 99 + 99) // 100 - 1)]
+        print("%s: %d calls  min %.1f  avg %.1f  max %.1f  p99 %.1f us (p99 from %d kept samples)"
+              % (name, total["count"], micros(total["min"], cps), micros(total["sum"] / total["count"], cps),
+                 micros(total["max"], cps), micros(p99, cps), len(samples)))
+        for line in histogram(samples, cps):
+            print(line)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,44 @@
+#!/usr/bin/env python3
+"""Converts a replay file written by the simulator into C for playing back on the board.
+
+    LEDPANEL_SIM_RECORD=game.rpl ./ledpanel-sim
+    python3 tools/replay_to_c.py game.rpl > replay.h
+
+Then build the firmware with -DREPLAY_INCLUDE='"replay.h"'. The board plays the
+replay from its recorded starting state, then hands over to the joysticks.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x5052
+VERSION = 1
+HEADER = struct.Struct("<HBBHHI6h")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("replay", help="replay file")
+    args = parser.parse_args()
+
+    data = open(args.replay, "rb").read()
+    if len(data) < HEADER.size:
+        sys.exit("%s: too short for a replay" % args.replay)
+    magic, version, paddle, width, height, ticks = HEADER.unpack_from(data)[:6]
+    if magic != MAGIC or version != VERSION:
+        sys.exit("%s: not a replay file" % args.replay)
+    if len(data) < HEADER.size + ticks:
+        sys.exit("%s: %d ticks of input expected, %d found" % (args.replay, ticks, len(data) - HEADER.size))
+
+    print("// Generated by tools/replay_to_c.py from %s: %dx%d display, %d ticks" % (args.replay, width, height, ticks))
+    print("const uint8_t replayData[] =")
+    print("{")
+    for i in range(0, len(data), 16):
+        print("\t" + ",".join("0x%02X" % b for b in data[i:i + 16]) + ",")
+    print("};")
+    print("const uint32_t replayDataLength = %d;" % len(data))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+"""Converts images into the run-length sprite format drawn by drawSprite in LEDPanel.c.
+
+Each input file becomes one frame of the sprite, so all of them must be the
+same size (at most 32x32). Inputs are binary or plain PPM files (P6 or P3),
+which most image editors can export. Up to 15 colours are allowed per sprite;
+the transparent colour (black unless --transparent says otherwise) is not
+drawn.
+
+    python3 tools/sprite_convert.py --name pompompurin art/pompompurin*.ppm
+
+The generated C goes to stdout, ready to paste into LEDPanel.c.
+
+Format: every row is a list of runs that together cover the sprite's width.
+Each run is one byte: the high nibble is the run length minus one (so runs
+are 1 to 16 pixels) and the low nibble is the palette index (0 = transparent).
+"""
+
+import argparse
+import sys
+
+MAX_SIZE = 32
+MAX_RUN = 16
+MAX_COLOURS = 15
+
+
+def read_token(data, pos):
+    """Returns the next whitespace-separated PPM header token and the position after it."""
+    while True:
+        while pos < len(data) and data[pos:pos + 1].isspace():
+            pos += 1
+        if data[pos:pos + 1] == b"#":
+            while pos < len(data) and data[pos:pos + 1] not in (b"\n", b"\r"):
+                pos += 1
+            continue
+        break
+    start = pos
+    while pos < len(data) and not data[pos:pos + 1].isspace():
+        pos += 1
+    return data[start:pos], pos
+
+
+def read_ppm(path):
+    """Returns (width, height, rows) where rows is a list of lists of (r, g, b) tuples."""
+    data = open(path, "rb").read()
+    magic, pos = read_token(data, 0)
+    width, pos = read_token(data, pos)
+    height, pos = read_token(data, pos)
+    maxval, pos = read_token(data, pos)
+    width, height, maxval = int(width), int(height), int(maxval)
+    if magic == b"P6":
+        if maxval > 255:
+            sys.exit("%s: 16-bit PPM files are not supported" % path)
+        pixels = data[pos + 1:pos + 1 + width * height * 3]
+        values = list(pixels)
+    elif magic == b"P3":
+        values = [int(v) for v in data[pos:].split()[:width * height * 3]]
+    else:
+        sys.exit("%s: not a PPM file" % path)
+    if len(values) < width * height * 3:
+        sys.exit("%s: image data is truncated" % path)
+    scale = 255.0 / maxval
+    rows = []
+    for y in range(height):
+        row = []
+        for x in range(width):
+            i = (y * width + x) * 3
+            row.append(tuple(int(round(v * scale)) for v in values[i:i + 3]))
+        rows.append(row)
+    return width, height, rows
+
+
+def encode_frame(rows, palette):
+    """Returns the run bytes for one frame, indexing colours through palette."""
+    out = []
+    for row in rows:
+        x = 0
+        while x < len(row):
+            index = palette[row[x]]
+            run = 1
+            while x + run < len(row) and run < MAX_RUN and palette[row[x + run]] == index:
+                run += 1
+            out.append((run - 1) << 4 | index)
+            x += run
+    return out
+
+
+def parse_colour(text):
+    text = text.lstrip("#")
+    if len(text) != 6:
+        raise argparse.ArgumentTypeError("colours are given as RRGGBB")
+    return tuple(int(text[i:i + 2], 16) for i in (0, 2, 4))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("images", nargs="+", help="PPM files, one per frame")
+    parser.add_argument("--name", required=True, help="C identifier for the sprite")
+    parser.add_argument("--transparent", type=parse_colour, default=(0, 0, 0),
+                        help="colour left undrawn, as RRGGBB (default 000000)")
+    args = parser.parse_args()
+
+    frames = [read_ppm(path) for path in args.images]
+    width, height = frames[0][0], frames[0][1]
+    if any(f[0] != width or f[1] != height for f in frames):
+        sys.exit("all frames must be the same size")
+    if width > MAX_SIZE or height > MAX_SIZE:
+        sys.exit("sprites can be at most %dx%d" % (MAX_SIZE, MAX_SIZE))
+
+    # Palette index 0 is transparent, the rest in order of first use
+    palette = {args.transparent: 0}
+    colours = []
+    for _, _, rows in frames:
+        for row in rows:
+            for colour in row:
+                if colour not in palette:
+                    colours.append(colour)
+                    palette[colour] = len(colours)
+    if len(colours) > MAX_COLOURS:
+        sys.exit("%d colours used, at most %d are allowed" % (len(colours), MAX_COLOURS))
+
+    data = []
+    offsets = []
+    for _, _, rows in frames:
+        offsets.append(len(data))
+        data.extend(encode_frame(rows, palette))
+
+    name = args.name
+    print("// Generated by tools/sprite_convert.py from %s" % ", ".join(args.images))
+    print("const struct paletteEntry %sPalette[] =" % name)
+    print("{")
+    print("\t{0,0,0}, // Transparent")
+    for colour in colours:
+        print("\t{%d,%d,%d}," % colour)
+    print("};")
+    print()
+    print("const uint16_t %sFrames[] = {%s};" % (name, ",".join(str(o) for o in offsets)))
+    print()
+    print("const uint8_t %sData[] = // %d bytes" % (name, len(data)))
+    print("{")
+    for i in range(0, len(data), 16):
+        print("\t" + ",".join("0x%02X" % b for b in data[i:i + 16]) + ",")
+    print("};")
+    print()
+    print("const struct sprite %s = {%d, %d, %d, %d, %sPalette, %sData, %sFrames};"
+          % (name, width, height, len(frames), len(colours) + 1, name, name, name))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""Encodes frames into the packet stream shown by a STREAM_MODE build of LEDPanel.c.
+
+Frames come from PPM files (one per frame, each the size of the display) or,
+with --pattern, from a built-in test pattern. They are sent as full frames
+every --keyframe frames and otherwise as deltas against the previous frame,
+whichever is smaller. Send the output to a serial port set to STREAM_BAUD, or
+to a file or FIFO read by a host build through LEDPANEL_STREAM:
+
+    python3 tools/stream_frames.py --pattern 500 -o frames.bin
+    python3 tools/stream_frames.py --fps 30 -o /dev/ttyACM0 clip*.ppm
+
+--rates prints the frame rate each baud rate can carry for the frames given,
+instead of writing them.
+
+The packet layout is described above the STREAM_* definitions in LEDPanel.c.
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+from sprite_convert import read_ppm
+
+SYNC = b"\xA5\x5A"
+FULL = 0
+DELTA = 1
+MAX_ITEM_WORDS = 255
+BAUD_RATES = [115200, 230400, 460800, 921600, 2000000]
+
+
+def fletcher16(data):
+    sum1 = sum2 = 0
+    for byte in data:
+        sum1 = (sum1 + byte) % 255
+        sum2 = (sum2 + sum1) % 255
+    return bytes([sum1, sum2])
+
+
+def pack_frame(pixels, width, height, depth):
+    """Packs rows of (r, g, b) tuples into struct frameBuffer's words: for each bit plane, least
+    significant first, the red, green and blue words of every row, 32 pixels to a word."""
+    words = []
+    row_words = width // 32
+    for plane in range(depth):
+        for channel in range(3):
+            for y in range(height):
+                for w in range(row_words):
+                    word = 0
+                    for bit in range(32):
+                        value = pixels[y][32 * w + bit][channel] >> (8 - depth)
+                        word |= ((value >> plane) & 1) << bit
+                    words.append(word)
+    return words
+
+
+def delta_items(old, new):
+    """Returns the delta payload taking old to new: runs of changed words."""
+    out = bytearray()
+    i = 0
+    while i < len(new):
+        if old[i] == new[i]:
+            i += 1
+            continue
+        start = i
+        while i < len(new) and old[i] != new[i] and i - start < MAX_ITEM_WORDS:
+            i += 1
+        out += struct.pack("<HB", start, i - start)
+        out += struct.pack("<%dI" % (i - start), *new[start:i])
+    return bytes(out)
+
+
+def packet(kind, sequence, payload):
+    body = struct.pack("<BBH", kind, sequence & 255, len(payload)) + payload
+    return SYNC + body + fletcher16(body)
+
+
+def encode(frames, keyframe):
+    """Yields one packet for each frame of words."""
+    previous = None
+    for index, words in enumerate(frames):
+        full = struct.pack("<%dI" % len(words), *words)
+        if previous is None or index % keyframe == 0:
+            yield packet(FULL, index, full)
+        else:
+            delta = delta_items(previous, words)
+            yield packet(DELTA, index, delta) if len(delta) < len(full) else packet(FULL, index, full)
+        previous = words
+
+
+def test_pattern(count, width, height, depth):
+    """Yields frames of a white column sweeping across a red-blue gradient that shifts every 8 frames."""
+    top = (1 << depth) - 1
+    for frame in range(count):
+        shift = frame // 8
+        pixels = []
+        for y in range(height):
+            row = []
+            for x in range(width):
+                if x == frame % width:
+                    row.append((255, 255, 255))
+                else:
+                    level = ((x + y + shift) % (width + height) * (top + 1) // (width + height)) << (8 - depth)
+                    row.append((level, 0, (top << (8 - depth)) - level))
+            pixels.append(row)
+        yield pixels
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("images", nargs="*", help="PPM files, one per frame")
+    parser.add_argument("--pattern", type=int, metavar="FRAMES", help="send this many frames of a test pattern")
+    parser.add_argument("--width", type=int, default=32, help="display width, PANEL_WIDTH * PANEL_CHAIN (default 32)")
+    parser.add_argument("--height", type=int, default=32, help="display height, PANEL_HEIGHT (default 32)")
+    parser.add_argument("--depth", type=int, default=1, help="COLOUR_DEPTH of the build (default 1)")
+    parser.add_argument("--keyframe", type=int, default=30, help="send a full frame every this many frames (default 30)")
+    parser.add_argument("--fps", type=float, help="pace the output to this many frames a second")
+    parser.add_argument("--corrupt", type=int, default=0, metavar="N", help="flip a byte in every Nth packet, for testing")
+    parser.add_argument("--drop", type=int, default=0, metavar="N", help="leave out every Nth packet, for testing")
+    parser.add_argument("--rates", action="store_true", help="print the frame rate per baud rate instead of sending")
+    parser.add_argument("-o", "--output", default="-", help="file, FIFO or serial port to write to (default stdout)")
+    args = parser.parse_args()
+
+    if args.width % 32:
+        sys.exit("the width must be a multiple of 32")
+    if args.pattern:
+        images = test_pattern(args.pattern, args.width, args.height, args.depth)
+    elif args.images:
+        images = []
+        for path in args.images:
+            width, height, pixels = read_ppm(path)
+            if (width, height) != (args.width, args.height):
+                sys.exit("%s is %dx%d, not %dx%d" % (path, width, height, args.width, args.height))
+            images.append(pixels)
+    else:
+        sys.exit("give PPM files or --pattern")
+
+    frames = (pack_frame(pixels, args.width, args.height, args.depth) for pixels in images)
+    packets = encode(frames, max(1, args.keyframe))
+
+    if args.rates:
+        sizes = [len(p) for p in packets]
+        average = sum(sizes) / len(sizes)
+        full = 8 + args.width * args.height * 3 * args.depth // 8
+        print("%d frames, %.0f bytes per packet on average, %d per full frame" % (len(sizes), average, full))
+        for baud in BAUD_RATES:
+            print("%8d baud: %7.1f frames/s, %7.1f full frames/s" % (baud, baud / 10 / average, baud / 10 / full))
+        return
+
+    out = sys.stdout.buffer if args.output == "-" else open(args.output, "wb", buffering=0)
+    start = time.monotonic()
+    for index, data in enumerate(packets):
+        if args.drop and index % args.drop == args.drop - 1:
+            continue
+        if args.corrupt and index % args.corrupt == args.corrupt - 1:
+            data = bytearray(data)
+            data[len(data) // 2] ^= 0x10
+        if args.fps:
+            delay = start + index / args.fps - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+        out.write(data)
+    out.flush()
+
+
+if __name__ == "__main__":
+    main()